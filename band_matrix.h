@@ -0,0 +1,142 @@
+/* Banded matrices distributed by row blocks.                           */
+
+/* A matrix with half bandwidth b (a(i,j) = 0 for |i - j| > b) is       */
+/* stored as 2b + 1 diagonals per row: row i holds a(i, i - b) to      */
+/* a(i, i + b), with zeros outside the matrix. Rows are split as in     */
+/* row_dist.h. A product y = A x then needs only the b entries of x     */
+/* next to the own rows from the left and right neighbours. The         */
+/* processes form a 1D Cartesian topology and the halo is exchanged     */
+/* with one MPI_Neighbor_alltoallv, so each process talks only to its   */
+/* two neighbours; there is no broadcast of x.                          */
+/* The matrix powers kernel computes x, A x, ..., A^s x with a single  */
+/* exchange of s * b entries per side instead of s exchanges of b: the */
+/* process also keeps the (s - 1) * b rows of A beyond its own on each */
+/* side (ghost rows, set up once) and computes A^k x on a region that  */
+/* shrinks by b rows per side and step, so it ends exactly on its own  */
+/* rows. The extra work is about s^2 * b rows per side, the saving is  */
+/* s - 1 message latencies per side.                                    */
+
+#ifndef BAND_MATRIX_H
+#define BAND_MATRIX_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "mpi.h"
+#include "matvec_kernels.h"
+#include "row_dist.h"
+
+typedef struct {
+  long n, b;                  /* Size and half bandwidth */
+  long rows, first;           /* Own rows */
+  long ghost;                 /* Ghost rows kept on each side */
+  int np, me;
+  MPI_Comm cart;              /* 1D non-periodic topology, same ranks */
+  float *a;                   /* rows + 2 * ghost rows of 2b + 1 diagonals */
+} band_matrix;
+
+/* Row g (global) of the stored band; g may be a ghost row */
+static inline float *band_row(const band_matrix *m, long g) {
+  return &m->a[(size_t)(g - m->first + m->ghost) * (2 * m->b + 1)];
+}
+
+/* Set up the distribution and the topology and allocate the own rows */
+/* plus 'ghost' rows on each side (collective). With ghost = 0 the own */
+/* rows are contiguous, ready for scatter_rows. Returns 0, or -1 when  */
+/* out of memory or when a process has fewer than 'ghost' rows (the    */
+/* halo would then have to come from beyond the neighbours).           */
+static inline int band_init(band_matrix *m, long n, long b, long ghost) {
+  int periodic = 0;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &m->np);
+  MPI_Comm_rank(MPI_COMM_WORLD, &m->me);
+  MPI_Cart_create(MPI_COMM_WORLD, 1, &m->np, &periodic, 0, &m->cart);
+  m->n = n;
+  m->b = b;
+  m->rows = num_rows(n, m->np, m->me);
+  m->first = first_row(n, m->np, m->me);
+  m->ghost = ghost;
+  m->a = malloc((size_t)(m->rows + 2 * ghost) * (2 * b + 1) * sizeof(float));
+  return (m->a == NULL || num_rows(n, m->np, m->np - 1) < ghost) ? -1 : 0;
+}
+
+/* band_init, then fill the stored rows from a function of the global */
+/* indices                                                            */
+static inline int band_create(band_matrix *m, long n, long b, long ghost,
+                              float (*gen)(long i, long j)) {
+  long g, k, w = 2 * b + 1;
+
+  if (band_init(m, n, b, ghost) != 0) return -1;
+  for (g = m->first - ghost; g < m->first + m->rows + ghost; g++) {
+    float *row = band_row(m, g);
+    for (k = 0; k < w; k++) {
+      long j = g - b + k;
+      row[k] = (g >= 0 && g < n && j >= 0 && j < n) ? gen(g, j) : 0.0f;
+    }
+  }
+  return 0;
+}
+
+static inline void band_free(band_matrix *m) {
+  free(m->a);
+  m->a = NULL;
+  MPI_Comm_free(&m->cart);
+}
+
+/* Fill the 'depth' entries of x on each side of the own rows from the */
+/* neighbours. x holds rows + 2 * depth entries, the own ones start at */
+/* x[depth]; entries outside the matrix are set to zero. Neighbours   */
+/* of a Cartesian topology come in the order left, right.             */
+static inline void band_halo(const band_matrix *m, float *x, long depth) {
+  int counts[2] = { (int)depth, (int)depth };
+  int sdispls[2] = { (int)depth, (int)m->rows };          /* own first, own last */
+  int rdispls[2] = { 0, (int)(depth + m->rows) };         /* left halo, right halo */
+
+  if (m->me == 0) memset(x, 0, depth * sizeof(float));
+  if (m->me == m->np - 1) memset(&x[depth + m->rows], 0, depth * sizeof(float));
+  MPI_Neighbor_alltoallv(x, counts, sdispls, MPI_FLOAT,
+                         x, counts, rdispls, MPI_FLOAT, m->cart);
+}
+
+/* y(g) = (A x)(g) for global rows g0 <= g < g1, which must lie within  */
+/* the stored rows. x and y are indexed by global row minus xbase and  */
+/* ybase.                                                               */
+static inline void band_matvec_range(const band_matrix *m, long g0, long g1,
+                                     const float *x, long xbase, float *y, long ybase) {
+  long g, w = 2 * m->b + 1;
+  for (g = g0; g < g1; g++) {
+    y[g - ybase] = (g >= 0 && g < m->n) ?
+                   dot_f32(w, band_row(m, g), &x[g - m->b - xbase]) : 0.0f;
+  }
+}
+
+/* One product on the own rows: x has rows + 2b entries with the own   */
+/* ones from x[b]; the halo is exchanged here. y gets the own rows.    */
+static inline void band_matvec(const band_matrix *m, float *x, float *y) {
+  band_halo(m, x, m->b);
+  band_matvec_range(m, m->first, m->first + m->rows, x, m->first - m->b, y, m->first);
+}
+
+/* Matrix powers: V[k * rows + i] = (A^k x)(first + i) for k = 0..s.  */
+/* x holds the own entries; work needs (s + 1) * (rows + 2 s b)       */
+/* floats. The ghost rows must be at least (s - 1) * b.               */
+static inline void band_powers(const band_matrix *m, int s, const float *x,
+                               float *V, float *work) {
+  long d = s * m->b, len = m->rows + 2 * d, base = m->first - d;
+  long k, lo, hi;
+  float *cur = work, *next;
+
+  memcpy(&cur[d], x, m->rows * sizeof(float));
+  band_halo(m, cur, d);
+  memcpy(V, x, m->rows * sizeof(float));
+  for (k = 1; k <= s; k++) {
+    next = work + k * len;
+    lo = m->first - (s - k) * m->b;
+    hi = m->first + m->rows + (s - k) * m->b;
+    memset(next, 0, len * sizeof(float));
+    band_matvec_range(m, lo, hi, cur, base, next, base);
+    memcpy(&V[k * m->rows], &next[d], m->rows * sizeof(float));
+    cur = next;
+  }
+}
+
+#endif /* BAND_MATRIX_H */
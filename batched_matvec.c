@@ -0,0 +1,128 @@
+/* A batched MPI program that computes a large number of independent      */
+/* 16x16 matrix-vector products y = A * x.                                */
+/* The batch is split into contiguous ranges of tiles, one range per      */
+/* process. Each process generates its own matrices and vectors, so there */
+/* is no MPI traffic per product; only the timings and the largest error */
+/* are combined on process 0 at the end.                                  */
+/* Matrices are stored interleaved (see matvec_kernels.h) so that the     */
+/* SIMD lanes of the local kernel work on different matrices.             */
+
+/* Compile the program with 'mpicc -O3 -march=native batched_matvec.c -o batched -lm' */
+/* Run the program with 'mpirun -np 4 batched [batch size]'                       */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "mpi.h"
+#include "matvec_kernels.h"
+
+#define NAMELEN 80          /* Max length of machine name */
+#define DEFAULT_BATCH 1048576L  /* Default number of products */
+#define REPEAT 5            /* Number of timed passes over the batch */
+
+/* Deterministic test data for product g of the global batch */
+static float gen_a(long g, int i, int j) { return (float)((g + i * BATCH_N + j) % 17 - 8); }
+static float gen_x(long g, int j)        { return (float)((g + j) % 5 + 1); }
+
+int main(int argc, char* argv[]) {
+  int i, j, l, r, np, me;
+  const int root = 0;         /* Root process for the reductions */
+  char myname[NAMELEN];       /* Local host name string */
+
+  long batch;                 /* Total number of products */
+  long tiles, first_tile, my_tiles, my_products, t;
+  float *A, *x, *y;           /* Local interleaved matrices and vectors */
+  double t0, elapsed, maxtime;
+  double maxerr, err;
+
+  MPI_Init(&argc, &argv);                /* Initialize MPI */
+  MPI_Comm_size(MPI_COMM_WORLD, &np);    /* Get nr of processes */
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);    /* Get own identifier */
+
+  gethostname(myname, NAMELEN);    /* Get host name */
+
+  batch = (argc > 1) ? atol(argv[1]) : DEFAULT_BATCH;
+  if (batch <= 0) {
+    if (me == root) printf("Batch size must be positive\n");
+    MPI_Finalize();
+    exit(0);
+  }
+
+  /* Split the tiles as evenly as possible over the processes */
+  tiles = (batch + BATCH_LANES - 1) / BATCH_LANES;
+  my_tiles = tiles / np + (me < tiles % np ? 1 : 0);
+  first_tile = me * (tiles / np) + (me < tiles % np ? me : tiles % np);
+  my_products = (first_tile + my_tiles) * BATCH_LANES;
+  if (my_products > batch) my_products = batch;
+  my_products -= first_tile * BATCH_LANES;
+  if (my_products < 0) my_products = 0;
+
+  A = malloc(my_tiles * BATCH_N * BATCH_N * BATCH_LANES * sizeof(float));
+  x = malloc(my_tiles * BATCH_N * BATCH_LANES * sizeof(float));
+  y = malloc(my_tiles * BATCH_N * BATCH_LANES * sizeof(float));
+  if (my_tiles > 0 && (A == NULL || x == NULL || y == NULL)) {
+    printf("Process %d on host %s: out of memory\n", me, myname);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  /* Generate the local part of the batch, padding lanes past the end with zeros */
+  for (t = 0; t < my_tiles; t++) {
+    for (l = 0; l < BATCH_LANES; l++) {
+      long g = (first_tile + t) * BATCH_LANES + l;
+      for (j = 0; j < BATCH_N; j++) {
+        for (i = 0; i < BATCH_N; i++) {
+          A[((t * BATCH_N + i) * BATCH_N + j) * BATCH_LANES + l] = (g < batch) ? gen_a(g, i, j) : 0.0f;
+        }
+        x[(t * BATCH_N + j) * BATCH_LANES + l] = (g < batch) ? gen_x(g, j) : 0.0f;
+      }
+    }
+  }
+
+  /* Warm up once, then time REPEAT passes */
+  matvec_f32_16_batched(my_tiles, A, x, y);
+  MPI_Barrier(MPI_COMM_WORLD);
+  t0 = MPI_Wtime();
+  for (r = 0; r < REPEAT; r++) {
+    matvec_f32_16_batched(my_tiles, A, x, y);
+  }
+  elapsed = MPI_Wtime() - t0;
+
+  /* Check every lane against a plain row-major computation of its own */
+  /* product; the padding lanes must stay zero                          */
+  maxerr = 0.0;
+  for (t = 0; t < my_tiles; t++) {
+    for (l = 0; l < BATCH_LANES; l++) {
+      long g = (first_tile + t) * BATCH_LANES + l;
+      for (i = 0; i < BATCH_N; i++) {
+        float ref = 0.0f;
+        for (j = 0; j < BATCH_N && g < batch; j++) {
+          ref += gen_a(g, i, j) * gen_x(g, j);
+        }
+        err = fabs(ref - y[(t * BATCH_N + i) * BATCH_LANES + l]);
+        if (err > maxerr) maxerr = err;
+      }
+    }
+  }
+
+  MPI_Reduce(&elapsed, &maxtime, 1, MPI_DOUBLE, MPI_MAX, root, MPI_COMM_WORLD);
+  err = maxerr;
+  MPI_Reduce(&err, &maxerr, 1, MPI_DOUBLE, MPI_MAX, root, MPI_COMM_WORLD);
+
+  printf("Process %d on host %s computed %ld products in %.3f s\n",
+         me, myname, my_products, elapsed / REPEAT);
+
+  if (me == root) {
+    printf("\nBatch of %ld %dx%d products on %d processes\n", batch, BATCH_N, BATCH_N, np);
+    printf("Time per pass:   %.6f s\n", maxtime / REPEAT);
+    printf("Throughput:      %.3e products/s\n", batch * REPEAT / maxtime);
+    printf("                 %.3f GFLOP/s\n", 2.0 * BATCH_N * BATCH_N * batch * REPEAT / maxtime * 1e-9);
+    printf("Max abs error:   %g\n", maxerr);
+  }
+
+  free(A);
+  free(x);
+  free(y);
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,296 @@
+/* An MPI conjugate gradient solver for A x = b on the distributed matrix-vector */
+/* product. Each process generates its own row block of a symmetric positive   */
+/* definite test matrix; b = A * (1, ..., 1), so the exact solution is known.   */
+
+/* Every iteration needs dot products, and every dot product is an             */
+/* MPI_Allreduce that costs a full network latency. Three variants are run:    */
+/*   classic   - textbook CG, two blocking reductions per iteration            */
+/*   fused     - Chronopoulos-Gear CG, both dot products in one reduction      */
+/*   pipelined - Ghysels-Vanroose pipelined CG, the one reduction is started  */
+/*               with MPI_Iallreduce and the next matrix-vector product runs  */
+/*               while it is in flight                                         */
+/* The reductions use the fused_reduce buffers of dist_reduce.h. For each      */
+/* variant process 0 prints the iterations, the time per iteration and the    */
+/* time spent waiting for reductions.                                          */
+/* A is stored in float, the solver vectors in double. The product sums in    */
+/* double as well: pipelined CG updates A w by recurrence, and with float      */
+/* sums its rounding errors stall it at a relative residual of about 1e-4.    */
+
+/* Compile the program with 'mpicc -O2 cg_solver.c -o cg -lm'                  */
+/* Run the program with                                                        */
+/*   'mpirun -np 4 cg [-n N] [-m classic|fused|pipelined|all] [-i max] [-e tol]' */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mpi.h"
+#include "row_dist.h"
+#include "dist_reduce.h"
+
+#define NAMELEN 80       /* Max length of machine name */
+
+#define CG_CLASSIC   0
+#define CG_FUSED     1
+#define CG_PIPELINED 2
+#define CG_NVARIANTS 3
+
+const char *variant_names[CG_NVARIANTS] = { "classic", "fused", "pipelined" };
+
+/* Local vectors of the solver, 'rows' elements each. A and the vector */
+/* it multiplies are float, the solver vectors and scalars are double.  */
+typedef struct {
+  long n, rows, first;
+  const float *A;             /* Local row block */
+  float *full;                /* Whole vector for the product */
+  float *in;                  /* Local slice of the vector in float */
+  int *counts, *displs;       /* Allgatherv layout */
+  double *x, *r, *p, *s, *w, *z, *q;
+} cg_state;
+
+/* y = A v for the local rows; v is the local slice of a distributed vector */
+static void dist_matvec(cg_state *cg, const double *v, double *y) {
+  long i;
+  for (i = 0; i < cg->rows; i++) cg->in[i] = (float)v[i];
+  MPI_Allgatherv(cg->in, (int)cg->rows, MPI_FLOAT, cg->full, cg->counts, cg->displs,
+                 MPI_FLOAT, MPI_COMM_WORLD);
+  for (i = 0; i < cg->rows; i++) y[i] = local_dot_f32(cg->n, &cg->A[i * cg->n], cg->full);
+}
+
+static double dot_f64(long n, const double *a, const double *b) {
+  double s = 0.0;
+  long i;
+  for (i = 0; i < n; i++) s += a[i] * b[i];
+  return s;
+}
+
+/* Solve from x = 0 until |r| <= tol |b|; returns the iterations and adds */
+/* the time spent in reductions to *tred                                   */
+static long cg_solve(int variant, cg_state *cg, const double *b, long maxit,
+                     double tol, double *tred) {
+  long i, k, rows = cg->rows;
+  double gamma, gamma_old = 0.0, delta, alpha = 0.0, alpha_old = 1.0, beta, bnorm, t;
+  fused_reduce fr;
+  int sg, sd;
+
+  fr_init(&fr);
+  for (i = 0; i < rows; i++) {
+    cg->x[i] = 0.0f;
+    cg->r[i] = b[i];
+    cg->p[i] = cg->s[i] = cg->z[i] = 0.0f;
+  }
+  fr_sum(&fr, dot_f64(rows, b, b));
+  fr_allreduce(&fr, MPI_COMM_WORLD);
+  bnorm = sqrt(fr_value(&fr, 0));
+  if (variant != CG_CLASSIC) dist_matvec(cg, cg->r, cg->w);
+
+  for (k = 0; k < maxit; k++) {
+    if (variant == CG_CLASSIC) {
+      /* gamma = r.r; delta = p.Ap after the product */
+      fr_reset(&fr);
+      sg = fr_sum(&fr, dot_f64(rows, cg->r, cg->r));
+      t = MPI_Wtime();
+      fr_allreduce(&fr, MPI_COMM_WORLD);
+      *tred += MPI_Wtime() - t;
+      gamma = fr_value(&fr, sg);
+      if (sqrt(gamma) <= tol * bnorm) break;
+      beta = (k > 0) ? gamma / gamma_old : 0.0;
+      for (i = 0; i < rows; i++) cg->p[i] = cg->r[i] + beta * cg->p[i];
+      dist_matvec(cg, cg->p, cg->q);
+      fr_reset(&fr);
+      sd = fr_sum(&fr, dot_f64(rows, cg->p, cg->q));
+      t = MPI_Wtime();
+      fr_allreduce(&fr, MPI_COMM_WORLD);
+      *tred += MPI_Wtime() - t;
+      delta = fr_value(&fr, sd);
+      alpha = gamma / delta;
+      for (i = 0; i < rows; i++) {
+        cg->x[i] += alpha * cg->p[i];
+        cg->r[i] -= alpha * cg->q[i];
+      }
+      gamma_old = gamma;
+      continue;
+    }
+
+    /* gamma = r.r and delta = w.r with w = A r, in one reduction */
+    fr_reset(&fr);
+    sg = fr_sum(&fr, dot_f64(rows, cg->r, cg->r));
+    sd = fr_sum(&fr, dot_f64(rows, cg->w, cg->r));
+    t = MPI_Wtime();
+    if (variant == CG_PIPELINED) {
+      /* q = A w overlaps the reduction */
+      fr_iallreduce(&fr, MPI_COMM_WORLD);
+      dist_matvec(cg, cg->w, cg->q);
+      t = MPI_Wtime();
+      fr_wait(&fr);
+    } else {
+      fr_allreduce(&fr, MPI_COMM_WORLD);
+    }
+    *tred += MPI_Wtime() - t;
+    gamma = fr_value(&fr, sg);
+    delta = fr_value(&fr, sd);
+    if (sqrt(gamma) <= tol * bnorm) break;
+
+    if (k > 0) {
+      beta = gamma / gamma_old;
+      alpha = gamma / (delta - beta * gamma / alpha_old);
+    } else {
+      beta = 0.0;
+      alpha = gamma / delta;
+    }
+    if (variant == CG_PIPELINED) {
+      /* z = A s and s = A p are kept up to date by recurrence */
+      for (i = 0; i < rows; i++) {
+        cg->z[i] = cg->q[i] + beta * cg->z[i];
+        cg->s[i] = cg->w[i] + beta * cg->s[i];
+        cg->p[i] = cg->r[i] + beta * cg->p[i];
+        cg->x[i] += alpha * cg->p[i];
+        cg->r[i] -= alpha * cg->s[i];
+        cg->w[i] -= alpha * cg->z[i];
+      }
+    } else {
+      for (i = 0; i < rows; i++) {
+        cg->p[i] = cg->r[i] + beta * cg->p[i];
+        cg->s[i] = cg->w[i] + beta * cg->s[i];
+        cg->x[i] += alpha * cg->p[i];
+        cg->r[i] -= alpha * cg->s[i];
+      }
+      dist_matvec(cg, cg->r, cg->w);
+    }
+    gamma_old = gamma;
+    alpha_old = alpha;
+  }
+  fr_free(&fr);
+  return k;
+}
+
+int main(int argc, char* argv[]) {
+  int p, opt, np, me, v;
+  const int root = 0;
+  char myname[NAMELEN];       /* Local host name string */
+
+  long n = 2048;              /* Matrix size */
+  long maxit = 500;           /* Iteration limit */
+  double tol = 1e-5;          /* Relative residual to reach */
+  int variant = -1;           /* -1 runs all variants */
+
+  long i, j, k;
+  float *localA;
+  double *b, *bufs;
+  double t0, t, tred, tmax, redmax, err;
+  cg_state cg;
+  fused_reduce fr;
+
+  MPI_Init(&argc, &argv);                /* Initialize MPI */
+  MPI_Comm_size(MPI_COMM_WORLD, &np);    /* Get nr of processes */
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);    /* Get own identifier */
+
+  gethostname(myname, NAMELEN);    /* Get host name */
+
+  while ((opt = getopt(argc, argv, "n:m:i:e:")) != -1) {
+    switch (opt) {
+    case 'n': n = atol(optarg); break;
+    case 'm':
+      for (v = 0; v < CG_NVARIANTS; v++) {
+        if (strcmp(optarg, variant_names[v]) == 0) variant = v;
+      }
+      break;
+    case 'i': maxit = atol(optarg); break;
+    case 'e': tol = atof(optarg); break;
+    default:
+      if (me == root) printf("Usage: cg [-n N] [-m classic|fused|pipelined|all] [-i max] [-e tol]\n");
+      MPI_Finalize();
+      exit(0);
+    }
+  }
+  if (n < np || n > 2147483647L) {
+    if (me == root) printf("N must be between the number of processes and 2^31-1\n");
+    MPI_Finalize();
+    exit(0);
+  }
+
+  cg.n = n;
+  cg.rows = num_rows(n, np, me);
+  cg.first = first_row(n, np, me);
+  localA = malloc((size_t)cg.rows * n * sizeof(float));
+  cg.full = malloc(n * sizeof(float));
+  cg.in = malloc(cg.rows * sizeof(float));
+  b = malloc(cg.rows * sizeof(double));
+  bufs = malloc(7 * cg.rows * sizeof(double));
+  cg.counts = malloc(np * sizeof(int));
+  cg.displs = malloc(np * sizeof(int));
+  if (localA == NULL || cg.full == NULL || cg.in == NULL ||
+      b == NULL || bufs == NULL) {
+    printf("Process %d on host %s: out of memory for N = %ld\n", me, myname, n);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  cg.A = localA;
+  cg.x = bufs;
+  cg.r = bufs + cg.rows;
+  cg.p = bufs + 2 * cg.rows;
+  cg.s = bufs + 3 * cg.rows;
+  cg.w = bufs + 4 * cg.rows;
+  cg.z = bufs + 5 * cg.rows;
+  cg.q = bufs + 6 * cg.rows;
+  for (p = 0; p < np; p++) {
+    cg.counts[p] = (int)num_rows(n, np, p);
+    cg.displs[p] = (int)first_row(n, np, p);
+  }
+
+  /* Local row block of the symmetric positive definite test matrix */
+  /* of power_iteration, and b = A * ones                            */
+  for (i = 0; i < cg.rows; i++) {
+    double sum = 0.0;
+    for (j = 0; j < n; j++) {
+      float a = 1.0f / (1.0f + labs(cg.first + i - j));
+      localA[(size_t)i * n + j] = a;
+      sum += a;
+    }
+    b[i] = sum;
+  }
+
+  if (me == root) {
+    printf("CG on a %ldx%ld matrix, %d processes, tolerance %g\n", n, n, np, tol);
+  }
+  fr_init(&fr);
+  for (v = 0; v < CG_NVARIANTS; v++) {
+    if (variant >= 0 && v != variant) continue;
+    tred = 0.0;
+    MPI_Barrier(MPI_COMM_WORLD);
+    t0 = MPI_Wtime();
+    k = cg_solve(v, &cg, b, maxit, tol, &tred);
+    t = MPI_Wtime() - t0;
+
+    /* Error against the exact solution, and the slowest rank's times */
+    fr_reset(&fr);
+    err = 0.0;
+    for (i = 0; i < cg.rows; i++) {
+      if (fabs(cg.x[i] - 1.0) > err) err = fabs(cg.x[i] - 1.0);
+    }
+    fr_max(&fr, err);
+    fr_max(&fr, t);
+    fr_max(&fr, tred);
+    fr_allreduce(&fr, MPI_COMM_WORLD);
+    err = fr_value(&fr, 0);
+    tmax = fr_value(&fr, 1);
+    redmax = fr_value(&fr, 2);
+    if (me == root) {
+      printf("%-10s %4ld iterations, max error %.2e, %.3f ms per iteration, "
+             "%.3f ms of it waiting for reductions\n",
+             variant_names[v], k, err, 1e3 * tmax / (k > 0 ? k : 1),
+             1e3 * redmax / (k > 0 ? k : 1));
+    }
+  }
+  fr_free(&fr);
+
+  free(localA);
+  free(cg.full);
+  free(cg.in);
+  free(b);
+  free(bufs);
+  free(cg.counts);
+  free(cg.displs);
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,254 @@
+/* A communication benchmark for the cluster, using the same one rank per      */
+/* process layout as the matrix programs.                                      */
+/* 1. Ping-pong between every pair of ranks, one pair at a time: the latency   */
+/*    of an 8 byte message and the bandwidth of a 4 MB message, printed as     */
+/*    two rank x rank matrices.                                                 */
+/* 2. MPI_Scatter, MPI_Bcast, MPI_Gather and MPI_Allreduce for message sizes   */
+/*    from 8 bytes to 8 MB in steps of 4x (bytes per rank block; the whole    */
+/*    buffer for Bcast and Allreduce), timed as the slowest rank's average.   */
+/* Process 0 also fits a latency-bandwidth (alpha-beta) model to the ping-pong */
+/* results, T(m) = alpha + beta * m, and saves everything to a profile file    */
+/* for the tuning code to read. The fit is done over all pairs, and separately */
+/* over the pairs on one node and on different nodes for the node-aware       */
+/* scatter of comm_model.h.                                                    */
+
+/* Compile the program with 'mpicc -O2 comm_bench.c -o comm_bench'             */
+/* Run the program with 'mpirun -np 4 comm_bench [profile file]'               */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpi.h"
+
+#define NAMELEN 80               /* Max length of machine name */
+#define LAT_BYTES 8              /* Message size for latency */
+#define BW_BYTES (4L << 20)      /* Message size for bandwidth */
+#define LAT_REPEAT 200           /* Round trips for latency */
+#define BW_REPEAT 10             /* Round trips for bandwidth */
+#define COLL_MIN 8               /* Smallest collective message */
+#define COLL_MAX (8L << 20)      /* Largest collective message, 8 * 4^k */
+#define COLL_BYTES_TOTAL (64L << 20)  /* Bytes moved per collective size point */
+
+enum { C_SCATTER, C_BCAST, C_GATHER, C_ALLREDUCE, NCOLLS };
+const char *coll_names[NCOLLS] = { "scatter", "bcast", "gather", "allreduce" };
+
+/* Fit alpha and beta over the pairs with (node[a] == node[b]) == same, */
+/* or all pairs when same < 0; returns the number of pairs              */
+int fit_alphabeta(int np, const double *lat, const double *bw, const int *node,
+                  int same, double *alpha, double *beta) {
+  int a, b, npairs = 0;
+  *alpha = *beta = 0.0;
+  for (a = 0; a < np; a++) {
+    for (b = a + 1; b < np; b++) {
+      double tbig = BW_BYTES / bw[a * np + b];
+      if (same >= 0 && (node[a] == node[b]) != same) continue;
+      *beta += (tbig - lat[a * np + b]) / (BW_BYTES - LAT_BYTES);
+      *alpha += lat[a * np + b];
+      npairs++;
+    }
+  }
+  if (npairs > 0) {
+    *beta /= npairs;
+    *alpha = *alpha / npairs - *beta * LAT_BYTES;
+  }
+  return npairs;
+}
+
+/* Half round-trip time of 'bytes' between ranks a and b (valid on a) */
+double pingpong(int a, int b, int me, char *buf, long bytes, int repeat) {
+  const int tag = 50;
+  int r;
+  double t0 = 0.0;
+
+  if (me == a) {
+    MPI_Send(buf, (int)bytes, MPI_BYTE, b, tag, MPI_COMM_WORLD);   /* warm up */
+    MPI_Recv(buf, (int)bytes, MPI_BYTE, b, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    t0 = MPI_Wtime();
+    for (r = 0; r < repeat; r++) {
+      MPI_Send(buf, (int)bytes, MPI_BYTE, b, tag, MPI_COMM_WORLD);
+      MPI_Recv(buf, (int)bytes, MPI_BYTE, b, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    }
+    return (MPI_Wtime() - t0) / (2.0 * repeat);
+  } else if (me == b) {
+    for (r = 0; r <= repeat; r++) {
+      MPI_Recv(buf, (int)bytes, MPI_BYTE, a, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+      MPI_Send(buf, (int)bytes, MPI_BYTE, a, tag, MPI_COMM_WORLD);
+    }
+  }
+  return 0.0;
+}
+
+/* Average time of one collective with 'bytes' per block, slowest rank */
+double time_collective(int coll, long bytes, int np, char *sbuf, char *rbuf) {
+  const int root = 0;
+  int r, repeat = (int)(COLL_BYTES_TOTAL / (bytes * np));
+  double t0, t, tmax;
+
+  if (repeat < 3) repeat = 3;
+  if (repeat > 1000) repeat = 1000;
+  MPI_Barrier(MPI_COMM_WORLD);
+  t0 = MPI_Wtime();
+  for (r = 0; r < repeat; r++) {
+    switch (coll) {
+    case C_SCATTER:
+      MPI_Scatter(sbuf, (int)bytes, MPI_BYTE, rbuf, (int)bytes, MPI_BYTE, root, MPI_COMM_WORLD);
+      break;
+    case C_BCAST:
+      MPI_Bcast(sbuf, (int)bytes, MPI_BYTE, root, MPI_COMM_WORLD);
+      break;
+    case C_GATHER:
+      MPI_Gather(sbuf, (int)bytes, MPI_BYTE, rbuf, (int)bytes, MPI_BYTE, root, MPI_COMM_WORLD);
+      break;
+    default:
+      MPI_Allreduce(sbuf, rbuf, (int)(bytes / sizeof(float)), MPI_FLOAT, MPI_SUM, MPI_COMM_WORLD);
+      break;
+    }
+  }
+  t = (MPI_Wtime() - t0) / repeat;
+  MPI_Reduce(&t, &tmax, 1, MPI_DOUBLE, MPI_MAX, root, MPI_COMM_WORLD);
+  return tmax;
+}
+
+int main(int argc, char* argv[]) {
+  int a, b, c, np, me;
+  const int root = 0;
+  char myname[NAMELEN];
+  const char *profile = (argc > 1) ? argv[1] : "comm_profile.txt";
+  char *buf, *sbuf, *rbuf;
+  double *lat, *bw, t;
+  double alpha = 0.0, beta = 0.0;
+  long bytes, collbytes;
+  int mynode, *node;
+  MPI_Comm nodecomm;
+  FILE *f = NULL;
+
+  MPI_Init(&argc, &argv);                /* Initialize MPI */
+  MPI_Comm_size(MPI_COMM_WORLD, &np);    /* Get nr of processes */
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);    /* Get own identifier */
+
+  gethostname(myname, NAMELEN);    /* Get host name */
+
+  /* Only the root of the scatter and the gather holds np blocks */
+  collbytes = (me == root) ? COLL_MAX * np : COLL_MAX;
+  buf = malloc(BW_BYTES);
+  sbuf = malloc(collbytes);
+  rbuf = malloc(collbytes);
+  lat = calloc(np * np, sizeof(double));
+  bw = calloc(np * np, sizeof(double));
+  node = malloc(np * sizeof(int));
+  if (buf == NULL || sbuf == NULL || rbuf == NULL || lat == NULL || bw == NULL ||
+      node == NULL) {
+    printf("Process %d on host %s: out of memory\n", me, myname);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  memset(buf, 1, BW_BYTES);
+  memset(sbuf, 1, collbytes);
+  memset(rbuf, 0, collbytes);
+
+  /* Node of each rank, named by its lowest rank */
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, me, MPI_INFO_NULL, &nodecomm);
+  MPI_Allreduce(&me, &mynode, 1, MPI_INT, MPI_MIN, nodecomm);
+  MPI_Comm_free(&nodecomm);
+  MPI_Gather(&mynode, 1, MPI_INT, node, 1, MPI_INT, root, MPI_COMM_WORLD);
+
+  /* Ping-pong between all pairs, one pair at a time */
+  for (a = 0; a < np; a++) {
+    for (b = a + 1; b < np; b++) {
+      MPI_Barrier(MPI_COMM_WORLD);
+      t = pingpong(a, b, me, buf, LAT_BYTES, LAT_REPEAT);
+      if (me == a) lat[a * np + b] = t;
+      t = pingpong(a, b, me, buf, BW_BYTES, BW_REPEAT);
+      if (me == a) bw[a * np + b] = BW_BYTES / t;
+    }
+  }
+  /* Each rank holds its own row of the pair results, collect them on root */
+  MPI_Reduce(me == root ? MPI_IN_PLACE : lat, lat, np * np, MPI_DOUBLE, MPI_SUM, root, MPI_COMM_WORLD);
+  MPI_Reduce(me == root ? MPI_IN_PLACE : bw, bw, np * np, MPI_DOUBLE, MPI_SUM, root, MPI_COMM_WORLD);
+
+  if (me == root) {
+    f = fopen(profile, "w");
+    if (f == NULL) printf("Cannot write %s, results are only printed\n", profile);
+    if (f) fprintf(f, "# comm_bench profile, %d ranks\n", np);
+
+    printf("Ping-pong latency [us] (%d bytes)\n     ", LAT_BYTES);
+    for (b = 0; b < np; b++) printf("%9d", b);
+    printf("\n");
+    for (a = 0; a < np; a++) {
+      printf("%4d ", a);
+      for (b = 0; b < np; b++) {
+        double v = a < b ? lat[a * np + b] : lat[b * np + a];
+        if (a == b) printf("%9s", "-");
+        else printf("%9.2f", v * 1e6);
+      }
+      printf("\n");
+    }
+    printf("\nPing-pong bandwidth [MB/s] (%ld bytes)\n     ", BW_BYTES);
+    for (b = 0; b < np; b++) printf("%9d", b);
+    printf("\n");
+    for (a = 0; a < np; a++) {
+      printf("%4d ", a);
+      for (b = 0; b < np; b++) {
+        double v = a < b ? bw[a * np + b] : bw[b * np + a];
+        if (a == b) printf("%9s", "-");
+        else printf("%9.1f", v * 1e-6);
+      }
+      printf("\n");
+    }
+
+    for (a = 0; a < np; a++) {
+      for (b = a + 1; b < np; b++) {
+        if (f) fprintf(f, "pingpong %d %d %.6e %.6e\n", a, b, lat[a * np + b], bw[a * np + b]);
+      }
+    }
+
+    /* Fit T(m) = alpha + beta * m from the two message sizes, averaged over the pairs */
+    if (fit_alphabeta(np, lat, bw, node, -1, &alpha, &beta) > 0) {
+      printf("\nPoint-to-point model: alpha = %.2f us, beta = %.3f ns/byte (%.1f MB/s)\n",
+             alpha * 1e6, beta * 1e9, 1e-6 / beta);
+      if (f) fprintf(f, "alphabeta %.6e %.6e\n", alpha, beta);
+    }
+    if (fit_alphabeta(np, lat, bw, node, 1, &alpha, &beta) > 0) {
+      printf("  within a node:  alpha = %.2f us, beta = %.3f ns/byte (%.1f MB/s)\n",
+             alpha * 1e6, beta * 1e9, 1e-6 / beta);
+      if (f) fprintf(f, "alphabeta_intra %.6e %.6e\n", alpha, beta);
+    }
+    if (fit_alphabeta(np, lat, bw, node, 0, &alpha, &beta) > 0) {
+      printf("  between nodes:  alpha = %.2f us, beta = %.3f ns/byte (%.1f MB/s)\n",
+             alpha * 1e6, beta * 1e9, 1e-6 / beta);
+      if (f) fprintf(f, "alphabeta_inter %.6e %.6e\n", alpha, beta);
+    }
+    printf("\nCollectives [us], bytes per block\n%10s", "bytes");
+    for (c = 0; c < NCOLLS; c++) printf("%12s", coll_names[c]);
+    printf("\n");
+  }
+
+  for (bytes = COLL_MIN; bytes <= COLL_MAX; bytes *= 4) {
+    double times[NCOLLS];
+    for (c = 0; c < NCOLLS; c++) {
+      times[c] = time_collective(c, bytes, np, sbuf, rbuf);
+    }
+    if (me == root) {
+      printf("%10ld", bytes);
+      for (c = 0; c < NCOLLS; c++) {
+        printf("%12.1f", times[c] * 1e6);
+        if (f) fprintf(f, "coll %s %ld %.6e\n", coll_names[c], bytes, times[c]);
+      }
+      printf("\n");
+    }
+  }
+
+  if (me == root && f != NULL) {
+    fclose(f);
+    printf("\nProfile saved to %s\n", profile);
+  }
+
+  free(buf);
+  free(sbuf);
+  free(rbuf);
+  free(lat);
+  free(bw);
+  free(node);
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,314 @@
+/* Collective algorithm selection from measured cluster characteristics. */
+
+/* The point-to-point cost of an m byte message is modelled as           */
+/* T(m) = alpha + beta * m, with alpha and beta read from the profile    */
+/* written by comm_bench. For p ranks and L = ceil(log2 p):              */
+/*   binomial tree broadcast       L * (alpha + beta * m)                */
+/*   scatter + ring allgather      (L + p - 1) * alpha                   */
+/*                                 + 2 * (p - 1) / p * beta * m          */
+/* so the broadcast of large vectors switches to scatter + allgather,    */
+/* while small ones stay on the tree. The same model picks the chunk     */
+/* size of the pipelined row scatter in scatter_matrix_mult.             */
+/* For scatters the profile also gives alpha and beta separately for    */
+/* ranks on one node and on different nodes. With b bytes per rank on   */
+/* N nodes of q ranks (p = N * q):                                       */
+/*   flat scatter over all ranks   L * alpha_inter                       */
+/*                                 + (p - 1) * b * beta_inter            */
+/*   node-aware scatter            log2 N * alpha_inter                  */
+/*                                 + (N - 1) * q * b * beta_inter        */
+/*                                 + log2 q * alpha_intra                */
+/*                                 + (q - 1) * b * beta_intra            */
+/* The flat one is the MPI library's scatter, which does not know the    */
+/* nodes, so every byte leaving the root is taken to cross the network.  */
+/* The node-aware one scatters node blocks among one leader per node,    */
+/* then each leader scatters within its node over shared memory. It      */
+/* wins when intra-node messages are cheaper, and is only used when the  */
+/* root is rank 0 and every node holds consecutive ranks, so that a node */
+/* block is contiguous in the send buffer.                               */
+
+#ifndef COMM_MODEL_H
+#define COMM_MODEL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpi.h"
+#include "row_dist.h"
+
+#define COMM_DEFAULT_ALPHA 100e-6    /* Without a profile: 100 us latency */
+#define COMM_DEFAULT_BETA  1e-8      /* and 100 MB/s */
+#define COMM_LINELEN 256
+
+#define BCAST_BINOMIAL 0
+#define BCAST_SCATTER_ALLGATHER 1
+
+#define SCATTER_FLAT 0
+#define SCATTER_NODE 1
+
+typedef struct {
+  double alpha;               /* Latency in seconds */
+  double beta;                /* Seconds per byte */
+  int measured;               /* Read from a profile */
+  double alpha_intra, beta_intra;  /* Between ranks of one node */
+  double alpha_inter, beta_inter;  /* Between nodes */
+  MPI_Comm node;              /* Ranks of this node, ordered by rank */
+  MPI_Comm leaders;           /* Lowest rank of every node, else MPI_COMM_NULL */
+  int nodes, ppn;             /* Number of nodes, most ranks on one node */
+  int node_first;             /* Lowest rank of this node */
+  int blocked;                /* Every node holds consecutive ranks */
+  int *first, *size;          /* Lowest rank and ranks of each node, on leaders */
+} comm_model;
+
+/* Read the alpha-beta lines of a comm_bench profile on rank 0 and share */
+/* them, and find the nodes of MPI_COMM_WORLD (collective). Falls back   */
+/* to the defaults without a profile, and to the overall alpha and beta  */
+/* for a profile without the intra- and inter-node fits.                 */
+static inline void comm_model_load(comm_model *m, const char *file) {
+  int me, nr, lo, hi, k;
+  double v[9] = { COMM_DEFAULT_ALPHA, COMM_DEFAULT_BETA, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+  char line[COMM_LINELEN];
+  FILE *f;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);
+  if (me == 0 && file != NULL && (f = fopen(file, "r")) != NULL) {
+    while (fgets(line, sizeof(line), f) != NULL) {
+      if (sscanf(line, "alphabeta %lf %lf", &v[0], &v[1]) == 2) v[2] = 1.0;
+      if (sscanf(line, "alphabeta_intra %lf %lf", &v[3], &v[4]) == 2) v[5] = 1.0;
+      if (sscanf(line, "alphabeta_inter %lf %lf", &v[6], &v[7]) == 2) v[8] = 1.0;
+    }
+    fclose(f);
+  }
+  MPI_Bcast(v, 9, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  m->alpha = v[0];
+  m->beta = v[1];
+  m->measured = (v[2] != 0.0);
+  m->alpha_intra = (v[5] != 0.0) ? v[3] : v[0];
+  m->beta_intra = (v[5] != 0.0) ? v[4] : v[1];
+  m->alpha_inter = (v[8] != 0.0) ? v[6] : v[0];
+  m->beta_inter = (v[8] != 0.0) ? v[7] : v[1];
+
+  /* Nodes: a communicator per node and one of the node leaders */
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, me, MPI_INFO_NULL, &m->node);
+  MPI_Comm_rank(m->node, &nr);
+  MPI_Comm_size(m->node, &m->ppn);
+  MPI_Comm_split(MPI_COMM_WORLD, nr == 0 ? 0 : MPI_UNDEFINED, me, &m->leaders);
+  MPI_Allreduce(&me, &lo, 1, MPI_INT, MPI_MIN, m->node);
+  MPI_Allreduce(&me, &hi, 1, MPI_INT, MPI_MAX, m->node);
+  m->node_first = lo;
+  m->blocked = (hi - lo + 1 == m->ppn);
+  m->first = m->size = NULL;
+  if (m->leaders != MPI_COMM_NULL) {
+    MPI_Comm_size(m->leaders, &m->nodes);
+    m->first = malloc(m->nodes * sizeof(int));
+    m->size = malloc(m->nodes * sizeof(int));
+    MPI_Allgather(&lo, 1, MPI_INT, m->first, 1, MPI_INT, m->leaders);
+    MPI_Allgather(&m->ppn, 1, MPI_INT, m->size, 1, MPI_INT, m->leaders);
+  }
+  k = (nr == 0);
+  MPI_Allreduce(MPI_IN_PLACE, &k, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+  m->nodes = k;
+  MPI_Allreduce(MPI_IN_PLACE, &m->ppn, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, &m->blocked, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+}
+
+/* Release the node communicators (collective) */
+static inline void comm_model_free(comm_model *m) {
+  MPI_Comm_free(&m->node);
+  if (m->leaders != MPI_COMM_NULL) MPI_Comm_free(&m->leaders);
+  free(m->first);
+  free(m->size);
+  m->first = m->size = NULL;
+}
+
+static inline int comm_log2(int p) {
+  int l = 0;
+  while ((1 << l) < p) l++;
+  return l;
+}
+
+static inline double cost_bcast_binomial(const comm_model *m, int p, double bytes) {
+  return comm_log2(p) * (m->alpha + m->beta * bytes);
+}
+
+static inline double cost_bcast_scatter_allgather(const comm_model *m, int p, double bytes) {
+  return (comm_log2(p) + p - 1) * m->alpha + 2.0 * (p - 1) / p * m->beta * bytes;
+}
+
+static inline int comm_bcast_choice(const comm_model *m, int p, double bytes) {
+  return cost_bcast_scatter_allgather(m, p, bytes) < cost_bcast_binomial(m, p, bytes) ?
+         BCAST_SCATTER_ALLGATHER : BCAST_BINOMIAL;
+}
+
+/* Broadcast as MPI_Scatterv of p blocks followed by MPI_Allgatherv */
+static inline void bcast_scatter_allgather(void *buf, int count, MPI_Datatype type,
+                                           int root, MPI_Comm comm) {
+  int p, np, me, size;
+  int *counts, *displs;
+  char *base = buf;
+
+  MPI_Comm_size(comm, &np);
+  MPI_Comm_rank(comm, &me);
+  MPI_Type_size(type, &size);
+  counts = malloc(np * sizeof(int));
+  displs = malloc(np * sizeof(int));
+  for (p = 0; p < np; p++) {
+    counts[p] = count / np + (p < count % np ? 1 : 0);
+    displs[p] = p * (count / np) + (p < count % np ? p : count % np);
+  }
+  MPI_Scatterv(buf, counts, displs, type,
+               me == root ? MPI_IN_PLACE : base + (size_t)displs[me] * size,
+               counts[me], type, root, comm);
+  MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, buf, counts, displs, type, comm);
+  free(counts);
+  free(displs);
+}
+
+/* Broadcast with the algorithm the model predicts to be faster; returns */
+/* the algorithm used                                                    */
+static inline int comm_bcast(const comm_model *m, void *buf, int count,
+                             MPI_Datatype type, int root, MPI_Comm comm) {
+  int np, size, algo;
+  MPI_Comm_size(comm, &np);
+  MPI_Type_size(type, &size);
+  algo = comm_bcast_choice(m, np, (double)count * size);
+  if (algo == BCAST_SCATTER_ALLGATHER && count >= np) {
+    bcast_scatter_allgather(buf, count, type, root, comm);
+  } else {
+    algo = BCAST_BINOMIAL;
+    MPI_Bcast(buf, count, type, root, comm);
+  }
+  return algo;
+}
+
+static inline double cost_scatter_flat(const comm_model *m, int p, double bytes) {
+  if (m->nodes == 1) return comm_log2(p) * m->alpha_intra + (p - 1) * bytes * m->beta_intra;
+  return comm_log2(p) * m->alpha_inter + (p - 1) * bytes * m->beta_inter;
+}
+
+static inline double cost_scatter_node(const comm_model *m, double bytes) {
+  return comm_log2(m->nodes) * m->alpha_inter +
+         (double)(m->nodes - 1) * m->ppn * bytes * m->beta_inter +
+         comm_log2(m->ppn) * m->alpha_intra + (m->ppn - 1) * bytes * m->beta_intra;
+}
+
+static inline int comm_scatter_choice(const comm_model *m, int p, double bytes) {
+  return m->nodes > 1 && m->blocked &&
+         cost_scatter_node(m, bytes) < cost_scatter_flat(m, p, bytes) ?
+         SCATTER_NODE : SCATTER_FLAT;
+}
+
+/* MPI_Scatterv over MPI_COMM_WORLD, node by node when the model predicts */
+/* that to be faster; returns the algorithm used. Unlike MPI_Scatterv,   */
+/* counts and displs must be given on all ranks, and a node's blocks     */
+/* must follow each other in sendbuf in rank order. Root may pass        */
+/* MPI_IN_PLACE as recvbuf.                                              */
+static inline int comm_scatterv(const comm_model *m, const void *sendbuf, const int *counts,
+                                const int *displs, MPI_Datatype type, void *recvbuf,
+                                int root) {
+  int np, me, k, j, f = m->node_first, q, ok = 1, size, *nc, *nd;
+  MPI_Aint lb, extent;
+  char *tmp = NULL;
+  const char *src;
+  double bytes = 0.0;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &np);
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);
+  MPI_Type_size(type, &size);
+  MPI_Type_get_extent(type, &lb, &extent);
+  MPI_Comm_size(m->node, &q);
+  for (k = 0; k < np; k++) {
+    if (counts[k] * (double)size > bytes) bytes = counts[k] * (double)size;
+  }
+  /* Each rank checks that the blocks of its node follow each other, */
+  /* so that all ranks take the same branch                          */
+  for (k = f + 1; k < f + q; k++) {
+    if (displs[k] != displs[k - 1] + counts[k - 1]) ok = 0;
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if (root != 0 || !ok || comm_scatter_choice(m, np, bytes) == SCATTER_FLAT) {
+    MPI_Scatterv(sendbuf, counts, displs, type, recvbuf, counts[me], type, root, MPI_COMM_WORLD);
+    return SCATTER_FLAT;
+  }
+
+  /* Node blocks to the leaders; root leads the first node */
+  if (m->leaders != MPI_COMM_NULL) {
+    int nn;
+    MPI_Comm_size(m->leaders, &nn);
+    nc = malloc(nn * sizeof(int));
+    nd = malloc(nn * sizeof(int));
+    for (k = 0; k < nn; k++) {
+      nc[k] = 0;
+      for (j = 0; j < m->size[k]; j++) nc[k] += counts[m->first[k] + j];
+      nd[k] = displs[m->first[k]];
+    }
+    MPI_Comm_rank(m->leaders, &k);
+    if (me != root) tmp = malloc((size_t)(nc[k] > 0 ? nc[k] : 1) * extent);
+    MPI_Scatterv(sendbuf, nc, nd, type, me == root ? MPI_IN_PLACE : tmp, nc[k], type,
+                 0, m->leaders);
+    free(nc);
+    free(nd);
+  }
+
+  /* Each leader scatters its node block within the node */
+  nc = malloc(q * sizeof(int));
+  nd = malloc(q * sizeof(int));
+  for (j = 0; j < q; j++) {
+    nc[j] = counts[f + j];
+    nd[j] = displs[f + j] - displs[f];
+  }
+  src = (me == root) ? (const char *)sendbuf + (size_t)displs[f] * extent : tmp;
+  MPI_Scatterv(src, nc, nd, type, recvbuf, counts[me], type, 0, m->node);
+  free(nc);
+  free(nd);
+  free(tmp);
+  return SCATTER_NODE;
+}
+
+/* scatter_rows of row_dist.h with each round sent by comm_scatterv;    */
+/* returns the algorithm of the last round                              */
+static inline int comm_scatter_rows(const comm_model *m, const void *A, void *localA,
+                                    long n, long rowbytes, int np,
+                                    MPI_Datatype rowtype, int root) {
+  long r, rounds, chunk = MAX_MSG_BYTES / rowbytes;
+  int *counts = malloc(np * sizeof(int));
+  int *displs = malloc(np * sizeof(int));
+  int algo = SCATTER_FLAT;
+
+  if (chunk < 1) chunk = 1;
+  rounds = num_rounds(n, np, chunk);
+
+  for (r = 0; r < rounds; r++) {
+    round_counts(n, np, chunk, r, counts, displs);
+    algo = comm_scatterv(m, A, counts, displs, rowtype,
+                         localA == MPI_IN_PLACE ? MPI_IN_PLACE :
+                         (char *)localA + (size_t)(r * chunk) * rowbytes, root);
+  }
+  free(counts);
+  free(displs);
+  return algo;
+}
+
+/* Rows per round for a pipelined scatter of 'rows' rows of 'rowbytes'   */
+/* bytes to each of p ranks, when computing one row takes 'row_time'     */
+/* seconds. A round costs c = L * alpha + beta * (p - 1) * chunk *       */
+/* rowbytes to scatter and d = chunk * row_time to compute; k rounds     */
+/* take about c + (k - 1) * max(c, d) + d.                               */
+static inline long comm_pipeline_chunk(const comm_model *m, int p, long rows,
+                                       long rowbytes, double row_time) {
+  long k, chunk, best_chunk = rows;
+  double c, d, t, best = 1e300;
+
+  for (k = 1; k <= rows; k = (k < 16) ? k + 1 : k + k / 8) {
+    chunk = (rows + k - 1) / k;
+    c = comm_log2(p) * m->alpha + m->beta * (p - 1) * (double)chunk * rowbytes;
+    d = chunk * row_time;
+    t = c + (k - 1) * (c > d ? c : d) + d;
+    if (t < best) {
+      best = t;
+      best_chunk = chunk;
+    }
+  }
+  return best_chunk;
+}
+
+#endif /* COMM_MODEL_H */
@@ -0,0 +1,324 @@
+/* Sparse matrices in CSR format distributed by contiguous row blocks.  */
+
+/* Process p owns global rows starts[p] to starts[p+1] - 1, which need  */
+/* not be equal in number (a partitioner may balance nonzeros instead). */
+/* The whole matrix is built on root and scattered; each process then   */
+/* renumbers its columns: own columns become 0..rows-1 and the columns  */
+/* of other processes it needs (the halo) follow at rows, rows+1, ...   */
+/* grouped by owner. csr_halo_setup finds which entries each process    */
+/* sends to whom and creates a distributed graph topology with only     */
+/* those neighbours, so a product exchanges the halo with one           */
+/* MPI_Neighbor_alltoallv.                                              */
+
+#ifndef CSR_MATRIX_H
+#define CSR_MATRIX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpi.h"
+
+typedef struct {
+  long n;                     /* Global rows and columns */
+  long rows, first;           /* Own rows */
+  long nnz;
+  long *rowptr;               /* rows + 1 */
+  long *col;                  /* Global, or local after csr_halo_setup */
+  float *val;
+} csr_matrix;
+
+/* Halo exchange plan of a distributed CSR matrix */
+typedef struct {
+  long nhalo;                 /* Halo entries, stored after the own rows */
+  int nneigh;                 /* Processes exchanged with */
+  int *neigh;                 /* Their ranks */
+  int *scounts, *sdispls;     /* Per neighbour, into sidx / the send buffer */
+  int *rcounts, *rdispls;     /* Per neighbour, into the halo */
+  long *sidx;                 /* Own local entries to send, in order */
+  float *sbuf;
+  MPI_Comm graph;             /* Distributed graph of the neighbours */
+} csr_halo;
+
+static inline void csr_free(csr_matrix *m) {
+  free(m->rowptr);
+  free(m->col);
+  free(m->val);
+  m->rowptr = NULL;
+  m->col = NULL;
+  m->val = NULL;
+}
+
+static inline int csr_alloc(csr_matrix *m, long n, long rows, long first, long nnz) {
+  m->n = n;
+  m->rows = rows;
+  m->first = first;
+  m->nnz = nnz;
+  m->rowptr = malloc((rows + 1) * sizeof(long));
+  m->col = malloc((nnz > 0 ? nnz : 1) * sizeof(long));
+  m->val = malloc((nnz > 0 ? nnz : 1) * sizeof(float));
+  return (m->rowptr == NULL || m->col == NULL || m->val == NULL) ? -1 : 0;
+}
+
+/* Process owning global row g */
+static inline int csr_owner(const long *starts, int np, long g) {
+  int lo = 0, hi = np - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (starts[mid] <= g) lo = mid;
+    else hi = mid - 1;
+  }
+  return lo;
+}
+
+/* Send every process its rows of the global matrix G on root           */
+/* (collective). starts has np + 1 entries and is needed on all ranks.  */
+static inline int csr_scatter(const csr_matrix *G, const long *starts,
+                              csr_matrix *m, int root) {
+  int np, me, p;
+  long i, n = 0, nnz = 0;
+  int *counts = NULL, *displs = NULL;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &np);
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);
+  if (me == root) n = G->n;
+  MPI_Bcast(&n, 1, MPI_LONG, root, MPI_COMM_WORLD);
+  if (me == root) {
+    counts = malloc(np * sizeof(int));
+    displs = malloc(np * sizeof(int));
+    for (p = 0; p < np; p++) {
+      long c = G->rowptr[starts[p + 1]] - G->rowptr[starts[p]];
+      if (p != root) MPI_Send(&c, 1, MPI_LONG, p, 80, MPI_COMM_WORLD);
+      else nnz = c;
+    }
+  } else {
+    MPI_Recv(&nnz, 1, MPI_LONG, root, 80, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  }
+  if (csr_alloc(m, n, starts[me + 1] - starts[me], starts[me], nnz) != 0) return -1;
+
+  /* Row pointers, rebased on every process */
+  if (me == root) {
+    for (p = 0; p < np; p++) {
+      counts[p] = (int)(starts[p + 1] - starts[p]);
+      displs[p] = (int)starts[p];
+    }
+  }
+  MPI_Scatterv(me == root ? G->rowptr : NULL, counts, displs, MPI_LONG,
+               m->rowptr, (int)m->rows, MPI_LONG, root, MPI_COMM_WORLD);
+  if (m->rows > 0) {
+    m->rowptr[m->rows] = m->rowptr[0] + nnz;
+    for (i = m->rows; i >= 0; i--) m->rowptr[i] -= m->rowptr[0];
+  } else {
+    m->rowptr[0] = 0;
+  }
+
+  if (me == root) {
+    for (p = 0; p < np; p++) {
+      counts[p] = (int)(G->rowptr[starts[p + 1]] - G->rowptr[starts[p]]);
+      displs[p] = (int)G->rowptr[starts[p]];
+    }
+  }
+  MPI_Scatterv(me == root ? G->col : NULL, counts, displs, MPI_LONG,
+               m->col, (int)nnz, MPI_LONG, root, MPI_COMM_WORLD);
+  MPI_Scatterv(me == root ? G->val : NULL, counts, displs, MPI_FLOAT,
+               m->val, (int)nnz, MPI_FLOAT, root, MPI_COMM_WORLD);
+  free(counts);
+  free(displs);
+  return 0;
+}
+
+/* The reverse of csr_scatter: collect the row blocks of m, with global */
+/* column indices, into G on root (collective)                          */
+static inline int csr_gather(const csr_matrix *m, const long *starts,
+                             csr_matrix *G, int root) {
+  int np, me, p, err = 0;
+  long i, nnz = m->rowptr[m->rows], total = 0;
+  long *nnzs = NULL;
+  int *counts = NULL, *displs = NULL;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &np);
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);
+  if (me == root) {
+    nnzs = malloc(np * sizeof(long));
+    counts = malloc(np * sizeof(int));
+    displs = malloc(np * sizeof(int));
+  }
+  MPI_Gather(&nnz, 1, MPI_LONG, nnzs, 1, MPI_LONG, root, MPI_COMM_WORLD);
+  if (me == root) {
+    for (p = 0; p < np; p++) total += nnzs[p];
+    err = csr_alloc(G, m->n, m->n, 0, total);
+  }
+  MPI_Bcast(&err, 1, MPI_INT, root, MPI_COMM_WORLD);
+  if (err != 0) {
+    free(nnzs);
+    free(counts);
+    free(displs);
+    return -1;
+  }
+
+  /* Row pointers are local; shift them by the nonzeros before each block */
+  if (me == root) {
+    for (p = 0; p < np; p++) {
+      counts[p] = (int)(starts[p + 1] - starts[p]);
+      displs[p] = (int)starts[p];
+    }
+  }
+  MPI_Gatherv(m->rowptr, (int)m->rows, MPI_LONG, me == root ? G->rowptr : NULL,
+              counts, displs, MPI_LONG, root, MPI_COMM_WORLD);
+  if (me == root) {
+    for (p = 0, total = 0; p < np; p++) {
+      for (i = starts[p]; i < starts[p + 1]; i++) G->rowptr[i] += total;
+      counts[p] = (int)nnzs[p];
+      displs[p] = (int)total;
+      total += nnzs[p];
+    }
+    G->rowptr[G->n] = total;
+  }
+  MPI_Gatherv(m->col, (int)nnz, MPI_LONG, me == root ? G->col : NULL,
+              counts, displs, MPI_LONG, root, MPI_COMM_WORLD);
+  MPI_Gatherv(m->val, (int)nnz, MPI_FLOAT, me == root ? G->val : NULL,
+              counts, displs, MPI_FLOAT, root, MPI_COMM_WORLD);
+  free(nnzs);
+  free(counts);
+  free(displs);
+  return 0;
+}
+
+static int csr_cmp_long(const void *a, const void *b) {
+  long x = *(const long *)a, y = *(const long *)b;
+  return (x > y) - (x < y);
+}
+
+/* Renumber the columns of m to local indices and build the exchange    */
+/* plan (collective). starts as for csr_scatter.                        */
+static inline void csr_halo_setup(csr_matrix *m, const long *starts, csr_halo *h) {
+  int np, p, k;
+  long i, nh = 0, *halo;
+  int *need, *sendto;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &np);
+
+  /* Distinct remote columns, sorted; sorted by global index also means */
+  /* grouped by owner                                                   */
+  halo = malloc((m->nnz > 0 ? m->nnz : 1) * sizeof(long));
+  for (i = 0; i < m->nnz; i++) {
+    if (m->col[i] < m->first || m->col[i] >= m->first + m->rows) halo[nh++] = m->col[i];
+  }
+  qsort(halo, nh, sizeof(long), csr_cmp_long);
+  for (i = 0, k = 0; i < nh; i++) {
+    if (k == 0 || halo[i] != halo[k - 1]) halo[k++] = halo[i];
+  }
+  nh = k;
+  h->nhalo = nh;
+
+  /* Local column indices */
+  for (i = 0; i < m->nnz; i++) {
+    long c = m->col[i];
+    if (c >= m->first && c < m->first + m->rows) {
+      m->col[i] = c - m->first;
+    } else {
+      long *f = bsearch(&c, halo, nh, sizeof(long), csr_cmp_long);
+      m->col[i] = m->rows + (f - halo);
+    }
+  }
+
+  /* How many entries this process needs from each process, and the     */
+  /* reverse: how many each process needs from this one                 */
+  need = calloc(np, sizeof(int));
+  sendto = malloc(np * sizeof(int));
+  for (i = 0; i < nh; i++) need[csr_owner(starts, np, halo[i])]++;
+  MPI_Alltoall(need, 1, MPI_INT, sendto, 1, MPI_INT, MPI_COMM_WORLD);
+
+  /* Neighbours are the processes exchanged with in either direction;   */
+  /* keeping the same list for sources and destinations keeps counts    */
+  /* and displacements symmetric                                        */
+  h->neigh = malloc(np * sizeof(int));
+  h->scounts = malloc(np * sizeof(int));
+  h->sdispls = malloc(np * sizeof(int));
+  h->rcounts = malloc(np * sizeof(int));
+  h->rdispls = malloc(np * sizeof(int));
+  h->nneigh = 0;
+  for (p = 0, i = 0, nh = 0; p < np; p++) {
+    if (need[p] == 0 && sendto[p] == 0) continue;
+    k = h->nneigh++;
+    h->neigh[k] = p;
+    h->rcounts[k] = need[p];
+    h->rdispls[k] = (int)nh;
+    h->scounts[k] = sendto[p];
+    h->sdispls[k] = (int)i;
+    nh += need[p];
+    i += sendto[p];
+  }
+  h->sidx = malloc((i > 0 ? i : 1) * sizeof(long));
+  h->sbuf = malloc((i > 0 ? i : 1) * sizeof(float));
+  /* Weighted by the entries exchanged, in case the library maps ranks */
+  MPI_Dist_graph_create_adjacent(MPI_COMM_WORLD, h->nneigh, h->neigh, h->rcounts,
+                                 h->nneigh, h->neigh, h->scounts,
+                                 MPI_INFO_NULL, 0, &h->graph);
+
+  /* Tell the owners which global entries to send */
+  MPI_Neighbor_alltoallv(halo, h->rcounts, h->rdispls, MPI_LONG,
+                         h->sidx, h->scounts, h->sdispls, MPI_LONG, h->graph);
+  for (k = 0; k < h->nneigh; k++) {
+    for (i = h->sdispls[k]; i < h->sdispls[k] + h->scounts[k]; i++) {
+      h->sidx[i] -= m->first;
+    }
+  }
+  free(halo);
+  free(need);
+  free(sendto);
+}
+
+static inline void csr_halo_free(csr_halo *h) {
+  MPI_Comm_free(&h->graph);
+  free(h->neigh);
+  free(h->scounts);
+  free(h->sdispls);
+  free(h->rcounts);
+  free(h->rdispls);
+  free(h->sidx);
+  free(h->sbuf);
+}
+
+/* Fill x[rows..rows+nhalo) from the neighbours; x[0..rows) is own */
+static inline void csr_halo_exchange(const csr_matrix *m, csr_halo *h, float *x) {
+  long i, ns = 0;
+  int k;
+  for (k = 0; k < h->nneigh; k++) ns += h->scounts[k];
+  for (i = 0; i < ns; i++) h->sbuf[i] = x[h->sidx[i]];
+  MPI_Neighbor_alltoallv(h->sbuf, h->scounts, h->sdispls, MPI_FLOAT,
+                         &x[m->rows], h->rcounts, h->rdispls, MPI_FLOAT, h->graph);
+}
+
+/* y = A x on the own rows, x in local numbering */
+static inline void csr_spmv_local(const csr_matrix *m, const float *x, float *y) {
+  long i, k;
+  for (i = 0; i < m->rows; i++) {
+    float s = 0.0f;
+    for (k = m->rowptr[i]; k < m->rowptr[i + 1]; k++) {
+      s += m->val[k] * x[m->col[k]];
+    }
+    y[i] = s;
+  }
+}
+
+/* Print the communication statistics of a distribution on root:       */
+/* halo entries (total and largest per process), neighbours and the    */
+/* nonzero imbalance (largest / average)                               */
+static inline void csr_halo_report(const char *label, const csr_matrix *m,
+                                   const csr_halo *h, int root) {
+  int np, me;
+  double v[3] = { (double)h->nhalo, (double)h->nneigh, (double)m->nnz };
+  double sum[3], max[3];
+
+  MPI_Comm_size(MPI_COMM_WORLD, &np);
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);
+  MPI_Reduce(v, sum, 3, MPI_DOUBLE, MPI_SUM, root, MPI_COMM_WORLD);
+  MPI_Reduce(v, max, 3, MPI_DOUBLE, MPI_MAX, root, MPI_COMM_WORLD);
+  if (me == root) {
+    printf("%-10s halo %9.0f entries (max %7.0f per process), neighbours max %3.0f avg %5.1f, "
+           "nonzero imbalance %.3f\n",
+           label, sum[0], max[0], max[1], sum[1] / np, max[2] / (sum[2] / np));
+  }
+}
+
+#endif /* CSR_MATRIX_H */
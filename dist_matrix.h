@@ -0,0 +1,194 @@
+/* Distributed dense matrices in row-block or 2D-block layout.          */
+
+/* An m x n float matrix is split over a pr x pc grid of processes;     */
+/* the row-block layout is the pr = np, pc = 1 case. Rows and columns   */
+/* are split as in row_dist.h, so blocks differ by at most one row or   */
+/* column. Each process stores its block row-major in 'a'. Processes   */
+/* keep their ranks of MPI_COMM_WORLD in the grid, rank p sits at grid  */
+/* position (p / pc, p % pc).                                           */
+/* Matrices with the same size and layout have the same blocks on each */
+/* process, so element-wise operations need no communication.          */
+
+#ifndef DIST_MATRIX_H
+#define DIST_MATRIX_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "mpi.h"
+#include "matvec_kernels.h"
+#include "row_dist.h"
+
+#define DIST_ROWS 0    /* Row blocks, pc = 1 */
+#define DIST_2D   1    /* pr x pc blocks, grid from MPI_Dims_create */
+
+typedef struct {
+  long m, n;                  /* Global size */
+  int layout;                 /* DIST_ROWS or DIST_2D */
+  int pr, pc;                 /* Process grid */
+  int myr, myc;               /* Own grid position */
+  long row0, col0;            /* Global index of the first local element */
+  long rows, cols;            /* Local block size */
+  float *a;                   /* Local block, rows x cols */
+} dist_matrix;
+
+/* Block owned by process p */
+static inline void dist_block(const dist_matrix *d, int p, long *row0, long *col0,
+                              long *rows, long *cols) {
+  int r = p / d->pc, c = p % d->pc;
+  *row0 = first_row(d->m, d->pr, r);
+  *rows = num_rows(d->m, d->pr, r);
+  *col0 = first_row(d->n, d->pc, c);
+  *cols = num_rows(d->n, d->pc, c);
+}
+
+/* Set up an m x n matrix in the given layout and allocate the local   */
+/* block (uninitialized). Returns 0, or -1 when out of memory.         */
+static inline int dist_create(dist_matrix *d, long m, long n, int layout) {
+  int np, me, dims[2] = { 0, 0 };
+
+  MPI_Comm_size(MPI_COMM_WORLD, &np);
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);
+  if (layout == DIST_2D) {
+    MPI_Dims_create(np, 2, dims);
+  } else {
+    dims[0] = np;
+    dims[1] = 1;
+  }
+  d->m = m;
+  d->n = n;
+  d->layout = layout;
+  d->pr = dims[0];
+  d->pc = dims[1];
+  d->myr = me / d->pc;
+  d->myc = me % d->pc;
+  dist_block(d, me, &d->row0, &d->col0, &d->rows, &d->cols);
+  d->a = malloc((size_t)(d->rows * d->cols > 0 ? d->rows * d->cols : 1) * sizeof(float));
+  return d->a == NULL ? -1 : 0;
+}
+
+static inline void dist_free(dist_matrix *d) {
+  free(d->a);
+  d->a = NULL;
+}
+
+/* Same size and layout, hence the same local blocks */
+static inline int dist_conform(const dist_matrix *a, const dist_matrix *b) {
+  return a->m == b->m && a->n == b->n && a->pr == b->pr && a->pc == b->pc;
+}
+
+/* Fill the local block from a function of the global indices */
+static inline void dist_generate(dist_matrix *d, float (*gen)(long i, long j)) {
+  long i, j;
+  for (i = 0; i < d->rows; i++) {
+    for (j = 0; j < d->cols; j++) {
+      d->a[i * d->cols + j] = gen(d->row0 + i, d->col0 + j);
+    }
+  }
+}
+
+/* Number of elements of process p's block; 0 when m or n is below the */
+/* grid dimension and p owns no rows or columns                         */
+static inline long dist_block_size(const dist_matrix *d, int p) {
+  long row0, col0, rows, cols;
+  dist_block(d, p, &row0, &col0, &rows, &cols);
+  return rows * cols;
+}
+
+/* Datatype of process p's block inside the global m x n array; the    */
+/* block must not be empty                                             */
+static inline MPI_Datatype dist_block_type(const dist_matrix *d, int p) {
+  MPI_Datatype t;
+  long row0, col0, rows, cols;
+  int sizes[2], subsizes[2], starts[2];
+
+  dist_block(d, p, &row0, &col0, &rows, &cols);
+  sizes[0] = (int)d->m;  sizes[1] = (int)d->n;
+  subsizes[0] = (int)rows;  subsizes[1] = (int)cols;
+  starts[0] = (int)row0;  starts[1] = (int)col0;
+  MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_FLOAT, &t);
+  MPI_Type_commit(&t);
+  return t;
+}
+
+/* Copy between root's block of the global array and its local block */
+static inline void dist_copy_own(dist_matrix *d, float *global, int to_local) {
+  long i;
+  for (i = 0; i < d->rows; i++) {
+    float *g = &global[(size_t)(d->row0 + i) * d->n + d->col0];
+    float *l = &d->a[(size_t)i * d->cols];
+    if (to_local) memcpy(l, g, d->cols * sizeof(float));
+    else memcpy(g, l, d->cols * sizeof(float));
+  }
+}
+
+/* Send every process its block of the global matrix on root. The      */
+/* blocks are sent straight out of the global array with a subarray    */
+/* datatype each, so root packs nothing. Empty blocks are not sent.    */
+static inline void dist_scatter(dist_matrix *d, const float *global, int root) {
+  const int tag = 60;
+  int np, me, p, k = 0;
+  MPI_Request *req;
+  MPI_Datatype *types;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &np);
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);
+  if (me != root) {
+    if (d->rows * d->cols == 0) return;
+    MPI_Recv(d->a, (int)(d->rows * d->cols), MPI_FLOAT, root, tag,
+             MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    return;
+  }
+  req = malloc(np * sizeof(MPI_Request));
+  types = malloc(np * sizeof(MPI_Datatype));
+  for (p = 0; p < np; p++) {
+    if (p == root || dist_block_size(d, p) == 0) continue;
+    types[k] = dist_block_type(d, p);
+    MPI_Isend(global, 1, types[k], p, tag, MPI_COMM_WORLD, &req[k]);
+    k++;
+  }
+  dist_copy_own(d, (float *)global, 1);
+  MPI_Waitall(k, req, MPI_STATUSES_IGNORE);
+  for (p = 0; p < k; p++) MPI_Type_free(&types[p]);
+  free(req);
+  free(types);
+}
+
+/* Collect all blocks into the global matrix on root */
+static inline void dist_gather(const dist_matrix *d, float *global, int root) {
+  const int tag = 61;
+  int np, me, p, k = 0;
+  MPI_Request *req;
+  MPI_Datatype *types;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &np);
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);
+  if (me != root) {
+    if (d->rows * d->cols == 0) return;
+    MPI_Send(d->a, (int)(d->rows * d->cols), MPI_FLOAT, root, tag, MPI_COMM_WORLD);
+    return;
+  }
+  req = malloc(np * sizeof(MPI_Request));
+  types = malloc(np * sizeof(MPI_Datatype));
+  for (p = 0; p < np; p++) {
+    if (p == root || dist_block_size(d, p) == 0) continue;
+    types[k] = dist_block_type(d, p);
+    MPI_Irecv(global, 1, types[k], p, tag, MPI_COMM_WORLD, &req[k]);
+    k++;
+  }
+  dist_copy_own((dist_matrix *)d, global, 0);
+  MPI_Waitall(k, req, MPI_STATUSES_IGNORE);
+  for (p = 0; p < k; p++) MPI_Type_free(&types[p]);
+  free(req);
+  free(types);
+}
+
+/* C = alpha * A + beta * B on the local blocks. C may be A or B for   */
+/* the in-place forms. Returns -1 if the matrices do not conform.      */
+static inline int dist_axpby(float alpha, const dist_matrix *A, float beta,
+                             const dist_matrix *B, dist_matrix *C) {
+  if (!dist_conform(A, B) || !dist_conform(A, C)) return -1;
+  axpby_f32(A->rows * A->cols, alpha, A->a, beta, B->a, C->a);
+  return 0;
+}
+
+#endif /* DIST_MATRIX_H */
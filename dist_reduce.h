@@ -0,0 +1,350 @@
+/* Distributed reductions over matrices and vectors.                    */
+
+/* Each process computes its partial results with the local kernels    */
+/* below and adds them to a fused_reduce buffer, which packs any mix of */
+/* sums, maxima, minima and MAXLOC / MINLOC pairs into one vector of    */
+/* doubles. fr_allreduce combines the whole buffer with one             */
+/* MPI_Allreduce, so several reductions cost one network latency. The   */
+/* buffer is sent as a single contiguous datatype that carries the kind */
+/* of every entry as an attribute, which the user-defined operation     */
+/* reads; MPI never splits one element of a datatype, so the operation  */
+/* always sees the whole buffer.                                        */
+/* fr_iallreduce starts the same reduction with MPI_Iallreduce, so that  */
+/* local work (typically the next matrix-vector product) runs while it   */
+/* is in flight; fr_wait completes it. The buffer must not be touched in */
+/* between.                                                              */
+/* Locations are global indices (i * n + j for matrices) and are exact  */
+/* in a double up to 2^53.                                              */
+
+#ifndef DIST_REDUCE_H
+#define DIST_REDUCE_H
+
+#include <stdlib.h>
+#include <math.h>
+#include "mpi.h"
+#include "dist_matrix.h"
+
+#define FR_SUM    0
+#define FR_MAX    1
+#define FR_MIN    2
+#define FR_MAXLOC 3   /* value; the next entry is its FR_INDEX */
+#define FR_MINLOC 4
+#define FR_INDEX  5
+
+#define RED_LANES 8   /* Partial sums per local kernel */
+
+typedef struct {
+  double *v;                  /* Packed values */
+  char *kind;                 /* FR_* of every entry */
+  int len, cap;
+  MPI_Datatype type;          /* Datatype of a reduction in flight */
+  MPI_Request req;            /* Its request, MPI_REQUEST_NULL when none */
+} fused_reduce;
+
+static int fr_keyval = MPI_KEYVAL_INVALID;
+static MPI_Op fr_op;
+
+static inline void fr_init(fused_reduce *fr) {
+  fr->v = NULL;
+  fr->kind = NULL;
+  fr->len = fr->cap = 0;
+  fr->type = MPI_DATATYPE_NULL;
+  fr->req = MPI_REQUEST_NULL;
+}
+
+/* Empty the buffer for the next round, keeping its memory */
+static inline void fr_reset(fused_reduce *fr) {
+  fr->len = 0;
+}
+
+static inline void fr_free(fused_reduce *fr) {
+  free(fr->v);
+  free(fr->kind);
+  fr_init(fr);
+}
+
+/* Append k entries of one kind; returns the slot of the first */
+static inline int fr_push(fused_reduce *fr, int kind, const double *v, int k) {
+  int i, slot = fr->len;
+  if (fr->len + k > fr->cap) {
+    fr->cap = 2 * (fr->len + k) + 16;
+    fr->v = realloc(fr->v, fr->cap * sizeof(double));
+    fr->kind = realloc(fr->kind, fr->cap);
+    if (fr->v == NULL || fr->kind == NULL) MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  for (i = 0; i < k; i++) {
+    fr->v[slot + i] = v[i];
+    fr->kind[slot + i] = (char)kind;
+  }
+  fr->len += k;
+  return slot;
+}
+
+static inline int fr_sum(fused_reduce *fr, double v) { return fr_push(fr, FR_SUM, &v, 1); }
+static inline int fr_max(fused_reduce *fr, double v) { return fr_push(fr, FR_MAX, &v, 1); }
+static inline int fr_min(fused_reduce *fr, double v) { return fr_push(fr, FR_MIN, &v, 1); }
+
+/* Value with its global index; ties go to the smaller index */
+static inline int fr_maxloc(fused_reduce *fr, double v, long index) {
+  int slot = fr_push(fr, FR_MAXLOC, &v, 1);
+  double i = (double)index;
+  fr_push(fr, FR_INDEX, &i, 1);
+  return slot;
+}
+
+static inline int fr_minloc(fused_reduce *fr, double v, long index) {
+  int slot = fr_push(fr, FR_MINLOC, &v, 1);
+  double i = (double)index;
+  fr_push(fr, FR_INDEX, &i, 1);
+  return slot;
+}
+
+static inline double fr_value(const fused_reduce *fr, int slot) { return fr->v[slot]; }
+static inline long fr_index(const fused_reduce *fr, int slot) { return (long)fr->v[slot + 1]; }
+
+/* The user-defined operation; the entry kinds come from the datatype */
+static void fr_combine(void *invec, void *inoutvec, int *len, MPI_Datatype *type) {
+  fused_reduce *fr;
+  double *in = invec, *io = inoutvec;
+  int flag, e, i;
+
+  MPI_Type_get_attr(*type, fr_keyval, &fr, &flag);
+  if (!flag) return;
+  for (e = 0; e < *len; e++, in += fr->len, io += fr->len) {
+    for (i = 0; i < fr->len; i++) {
+      switch (fr->kind[i]) {
+      case FR_SUM: io[i] += in[i]; break;
+      case FR_MAX: if (in[i] > io[i]) io[i] = in[i]; break;
+      case FR_MIN: if (in[i] < io[i]) io[i] = in[i]; break;
+      case FR_MAXLOC:
+        if (in[i] > io[i] || (in[i] == io[i] && in[i + 1] < io[i + 1])) {
+          io[i] = in[i];
+          io[i + 1] = in[i + 1];
+        }
+        i++;
+        break;
+      case FR_MINLOC:
+        if (in[i] < io[i] || (in[i] == io[i] && in[i + 1] < io[i + 1])) {
+          io[i] = in[i];
+          io[i + 1] = in[i + 1];
+        }
+        i++;
+        break;
+      default: break;
+      }
+    }
+  }
+}
+
+/* Datatype of the whole buffer, tagged with its entry kinds */
+static inline MPI_Datatype fr_type(fused_reduce *fr) {
+  MPI_Datatype t;
+  if (fr_keyval == MPI_KEYVAL_INVALID) {
+    MPI_Type_create_keyval(MPI_TYPE_NULL_COPY_FN, MPI_TYPE_NULL_DELETE_FN, &fr_keyval, NULL);
+    MPI_Op_create(fr_combine, 1, &fr_op);
+  }
+  MPI_Type_contiguous(fr->len, MPI_DOUBLE, &t);
+  MPI_Type_commit(&t);
+  MPI_Type_set_attr(t, fr_keyval, fr);
+  return t;
+}
+
+/* Combine the buffers of all processes of comm in place (collective; */
+/* all processes must have pushed the same kinds in the same order)   */
+static inline void fr_allreduce(fused_reduce *fr, MPI_Comm comm) {
+  MPI_Datatype t;
+  if (fr->len == 0) return;
+  t = fr_type(fr);
+  MPI_Allreduce(MPI_IN_PLACE, fr->v, 1, t, fr_op, comm);
+  MPI_Type_free(&t);
+}
+
+/* Start the same reduction without waiting for it (collective) */
+static inline void fr_iallreduce(fused_reduce *fr, MPI_Comm comm) {
+  if (fr->len == 0) return;
+  fr->type = fr_type(fr);
+  MPI_Iallreduce(MPI_IN_PLACE, fr->v, 1, fr->type, fr_op, comm, &fr->req);
+}
+
+/* Complete a reduction started with fr_iallreduce */
+static inline void fr_wait(fused_reduce *fr) {
+  if (fr->req == MPI_REQUEST_NULL) return;
+  MPI_Wait(&fr->req, MPI_STATUS_IGNORE);
+  MPI_Type_free(&fr->type);
+}
+
+/* Local kernels. RED_LANES independent partial sums let the compiler */
+/* vectorize without reassociating floating point additions.          */
+
+/* Sum and sum of squares of n floats */
+static inline void local_sums_f32(long n, const float *a, double *sum, double *sumsq) {
+  double s[RED_LANES] = { 0 }, q[RED_LANES] = { 0 };
+  long j, k, nb = n - n % RED_LANES;
+  for (j = 0; j < nb; j += RED_LANES) {
+    for (k = 0; k < RED_LANES; k++) {
+      s[k] += a[j + k];
+      q[k] += (double)a[j + k] * a[j + k];
+    }
+  }
+  for (; j < n; j++) {
+    s[0] += a[j];
+    q[0] += (double)a[j] * a[j];
+  }
+  *sum = *sumsq = 0.0;
+  for (k = 0; k < RED_LANES; k++) {
+    *sum += s[k];
+    *sumsq += q[k];
+  }
+}
+
+/* Dot product of n floats in double */
+static inline double local_dot_f32(long n, const float *a, const float *b) {
+  double s[RED_LANES] = { 0 }, r = 0.0;
+  long j, k, nb = n - n % RED_LANES;
+  for (j = 0; j < nb; j += RED_LANES) {
+    for (k = 0; k < RED_LANES; k++) {
+      s[k] += (double)a[j + k] * b[j + k];
+    }
+  }
+  for (; j < n; j++) s[0] += (double)a[j] * b[j];
+  for (k = 0; k < RED_LANES; k++) r += s[k];
+  return r;
+}
+
+/* Smallest and largest of n > 0 floats with their first positions */
+static inline void local_minmax_f32(long n, const float *a, float *min, long *imin,
+                                    float *max, long *imax) {
+  long j;
+  *min = *max = a[0];
+  *imin = *imax = 0;
+  for (j = 1; j < n; j++) {
+    if (a[j] < *min) { *min = a[j]; *imin = j; }
+    if (a[j] > *max) { *max = a[j]; *imax = j; }
+  }
+}
+
+/* Norms of a distributed matrix. The Frobenius norm needs one sum.   */
+/* The 1-norm (largest column sum of |a|) and the infinity norm       */
+/* (largest row sum) are a single maximum when a process owns whole   */
+/* columns or rows, otherwise the column or row sums are reduced as a */
+/* vector. Returns the slot for dist_norms_get.                       */
+static inline int dist_norms_push(fused_reduce *fr, const dist_matrix *d) {
+  long i, j;
+  double sum, sumsq, best;
+  double *col = calloc(d->n, sizeof(double));
+  double *row = calloc(d->m, sizeof(double));
+  int slot;
+
+  if (col == NULL || row == NULL) MPI_Abort(MPI_COMM_WORLD, 1);
+  local_sums_f32(d->rows * d->cols, d->a, &sum, &sumsq);
+  for (i = 0; i < d->rows; i++) {
+    const float *a = &d->a[i * d->cols];
+    double *c = &col[d->col0];
+    double r = 0.0;
+    for (j = 0; j < d->cols; j++) {
+      c[j] += fabsf(a[j]);
+      r += fabsf(a[j]);
+    }
+    row[d->row0 + i] = r;
+  }
+  slot = fr_sum(fr, sumsq);
+  if (d->pr == 1) {
+    for (best = 0.0, j = 0; j < d->n; j++) if (col[j] > best) best = col[j];
+    fr_max(fr, best);
+  } else {
+    fr_push(fr, FR_SUM, col, (int)d->n);
+  }
+  if (d->pc == 1) {
+    for (best = 0.0, i = 0; i < d->m; i++) if (row[i] > best) best = row[i];
+    fr_max(fr, best);
+  } else {
+    fr_push(fr, FR_SUM, row, (int)d->m);
+  }
+  free(col);
+  free(row);
+  return slot;
+}
+
+static inline void dist_norms_get(const fused_reduce *fr, int slot, const dist_matrix *d,
+                                  double *fro, double *one, double *inf) {
+  const double *v = &fr->v[slot];
+  long i, k = (d->pr == 1) ? 1 : d->n;
+  *fro = sqrt(v[0]);
+  *one = *inf = 0.0;
+  for (i = 0; i < k; i++) if (v[1 + i] > *one) *one = v[1 + i];
+  for (i = 0; i < ((d->pc == 1) ? 1 : d->m); i++) if (v[1 + k + i] > *inf) *inf = v[1 + k + i];
+}
+
+/* Sum, minimum and maximum with their global indices i * n + j.      */
+/* Returns the slot for dist_stats_get.                               */
+static inline int dist_stats_push(fused_reduce *fr, const dist_matrix *d) {
+  double sum = 0.0, s, q, lo = INFINITY, hi = -INFINITY;
+  long i, ilo = -1, ihi = -1, jlo, jhi;
+  float mn, mx;
+  int slot;
+
+  for (i = 0; i < d->rows && d->cols > 0; i++) {
+    const float *a = &d->a[i * d->cols];
+    local_sums_f32(d->cols, a, &s, &q);
+    sum += s;
+    local_minmax_f32(d->cols, a, &mn, &jlo, &mx, &jhi);
+    if (mn < lo) {
+      lo = mn;
+      ilo = (d->row0 + i) * d->n + d->col0 + jlo;
+    }
+    if (mx > hi) {
+      hi = mx;
+      ihi = (d->row0 + i) * d->n + d->col0 + jhi;
+    }
+  }
+  slot = fr_sum(fr, sum);
+  fr_minloc(fr, lo, ilo);
+  fr_maxloc(fr, hi, ihi);
+  return slot;
+}
+
+static inline void dist_stats_get(const fused_reduce *fr, int slot, double *sum,
+                                  double *min, long *imin, double *max, long *imax) {
+  *sum = fr_value(fr, slot);
+  *min = fr_value(fr, slot + 1);
+  *imin = fr_index(fr, slot + 1);
+  *max = fr_value(fr, slot + 3);
+  *imax = fr_index(fr, slot + 3);
+}
+
+/* Frobenius inner product sum(A .* B) of conforming matrices.        */
+/* Returns the slot; the result is fr_value(fr, slot).                */
+static inline int dist_dot_push(fused_reduce *fr, const dist_matrix *A, const dist_matrix *B) {
+  return fr_sum(fr, dist_conform(A, B) ? local_dot_f32(A->rows * A->cols, A->a, B->a) : NAN);
+}
+
+/* One-call forms, each a single MPI_Allreduce */
+static inline void dist_norms(const dist_matrix *d, double *fro, double *one, double *inf) {
+  fused_reduce fr;
+  int slot;
+  fr_init(&fr);
+  slot = dist_norms_push(&fr, d);
+  fr_allreduce(&fr, MPI_COMM_WORLD);
+  dist_norms_get(&fr, slot, d, fro, one, inf);
+  fr_free(&fr);
+}
+
+static inline double dist_dot(const dist_matrix *A, const dist_matrix *B) {
+  fused_reduce fr;
+  double r;
+  fr_init(&fr);
+  dist_dot_push(&fr, A, B);
+  fr_allreduce(&fr, MPI_COMM_WORLD);
+  r = fr_value(&fr, 0);
+  fr_free(&fr);
+  return r;
+}
+
+/* Dot product of two vectors distributed over comm, n local elements */
+static inline double vec_dot(long n, const float *x, const float *y, MPI_Comm comm) {
+  double local = local_dot_f32(n, x, y), r;
+  MPI_Allreduce(&local, &r, 1, MPI_DOUBLE, MPI_SUM, comm);
+  return r;
+}
+
+#endif /* DIST_REDUCE_H */
@@ -0,0 +1,194 @@
+/* An MPI program that multiplies a matrix A (NxN) with a vector X (Nx1) stored  */
+/* in reduced precision. Rows of A are scattered and X is broadcast in the       */
+/* storage type, so int8 moves 4x and int16 / bfloat16 move 2x less data than    */
+/* float over the network and through memory.                                    */
+/*   f32  - float storage, float accumulation (reference)                        */
+/*   bf16 - bfloat16 storage, float accumulation                                 */
+/*   i16  - int16 storage, int32 accumulation                                    */
+/*   i8   - int8 storage, int32 accumulation                                     */
+/* Process 0 gathers the result, checks it against the exact value and prints   */
+/* the bytes moved and the distribution and compute times for each type.         */
+
+/* Compile the program with 'mpicc -O3 -march=native lowp_matrix_mult.c -o lowp' */
+/* Run the program with 'mpirun -np 4 lowp [N] [f32|bf16|i16|i8|all]'            */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpi.h"
+#include "matvec_kernels.h"
+#include "row_dist.h"
+
+#define DEFAULT_N 4096       /* Default matrix size N x N */
+#define REPEAT 10            /* Timed repetitions of the local product */
+
+#define TYPE_F32  0
+#define TYPE_BF16 1
+#define TYPE_I16  2
+#define TYPE_I8   3
+#define NTYPES    4
+
+const char *type_names[NTYPES] = { "f32", "bf16", "i16", "i8" };
+const int type_size[NTYPES] = { 4, 2, 2, 1 };
+
+/* Test data: small integers that are exact in every storage type */
+static int gen_a(long i, long j, long n) { return (int)((i * n + j) % 15) - 7; }
+static int gen_x(long j)                 { return (int)(j % 7) - 3; }
+
+/* Store integer value v as element k of an array of the given type */
+static void store(int type, void *buf, size_t k, int v) {
+  switch (type) {
+  case TYPE_F32:  ((float *)buf)[k] = (float)v; break;
+  case TYPE_BF16: ((uint16_t *)buf)[k] = f32_to_bf16((float)v); break;
+  case TYPE_I16:  ((int16_t *)buf)[k] = (int16_t)v; break;
+  default:        ((int8_t *)buf)[k] = (int8_t)v; break;
+  }
+}
+
+static MPI_Datatype mpi_type(int type) {
+  switch (type) {
+  case TYPE_F32:  return MPI_FLOAT;
+  case TYPE_BF16: return MPI_UINT16_T;
+  case TYPE_I16:  return MPI_INT16_T;
+  default:        return MPI_INT8_T;
+  }
+}
+
+/* Local product; float results for f32/bf16, int32 results otherwise */
+static void local_matvec(int type, long rows, long n, const void *A,
+                         const void *x, void *y) {
+  switch (type) {
+  case TYPE_F32:  matvec_f32(rows, n, A, x, y); break;
+  case TYPE_BF16: matvec_bf16(rows, n, A, x, y); break;
+  case TYPE_I16:  matvec_i16(rows, n, A, x, y); break;
+  default:        matvec_i8(rows, n, A, x, y); break;
+  }
+}
+
+/* Distribute, multiply and gather for one storage type */
+static void run(int type, long n, int np, int me, int root) {
+  int p;
+  long i, j;
+  long rows = num_rows(n, np, me);
+  size_t es = type_size[type];
+  MPI_Datatype rowtype, restype = (type == TYPE_F32 || type == TYPE_BF16) ? MPI_FLOAT : MPI_INT32_T;
+  void *A = NULL, *x, *localA;
+  int32_t *localY, *Y = NULL;          /* 4-byte results, float or int32 */
+  int *counts = NULL, *displs = NULL;
+  double t0, tcomm, tcomp, maxcomm, maxcomp;
+
+  x = malloc(n * es);
+  localA = malloc((size_t)rows * n * es);
+  localY = malloc(rows * sizeof(int32_t));
+  if (me == root) {
+    A = malloc((size_t)n * n * es);
+    Y = malloc(n * sizeof(int32_t));
+    counts = malloc(np * sizeof(int));
+    displs = malloc(np * sizeof(int));
+  }
+  if (x == NULL || localA == NULL || localY == NULL ||
+      (me == root && (A == NULL || Y == NULL || counts == NULL || displs == NULL))) {
+    printf("Process %d: out of memory for N = %ld (%s)\n", me, n, type_names[type]);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  if (me == root) {
+    for (i = 0; i < n; i++) {
+      for (j = 0; j < n; j++) {
+        store(type, A, (size_t)i * n + j, gen_a(i, j, n));
+      }
+      store(type, x, i, gen_x(i));
+    }
+  }
+
+  MPI_Type_contiguous((int)n, mpi_type(type), &rowtype);
+  MPI_Type_commit(&rowtype);
+
+  /* Scatter the rows of A and broadcast X in the storage type */
+  MPI_Barrier(MPI_COMM_WORLD);
+  t0 = MPI_Wtime();
+  scatter_rows(A, localA, n, n * (long)es, np, me, rowtype, root);
+  MPI_Bcast(x, (int)n, mpi_type(type), root, MPI_COMM_WORLD);
+  tcomm = MPI_Wtime() - t0;
+
+  t0 = MPI_Wtime();
+  for (p = 0; p < REPEAT; p++) {
+    local_matvec(type, rows, n, localA, x, localY);
+  }
+  tcomp = (MPI_Wtime() - t0) / REPEAT;
+
+  if (me == root) {
+    for (p = 0; p < np; p++) {
+      counts[p] = (int)num_rows(n, np, p);
+      displs[p] = (int)first_row(n, np, p);
+    }
+  }
+  MPI_Gatherv(localY, (int)rows, restype, Y, counts, displs, restype, root, MPI_COMM_WORLD);
+
+  MPI_Reduce(&tcomm, &maxcomm, 1, MPI_DOUBLE, MPI_MAX, root, MPI_COMM_WORLD);
+  MPI_Reduce(&tcomp, &maxcomp, 1, MPI_DOUBLE, MPI_MAX, root, MPI_COMM_WORLD);
+
+  if (me == root) {
+    long errors = 0;
+    for (i = 0; i < n; i++) {
+      long expect = 0, got;
+      for (j = 0; j < n; j++) {
+        expect += (long)gen_a(i, j, n) * gen_x(j);
+      }
+      if (restype == MPI_FLOAT) {
+        float f;
+        memcpy(&f, &Y[i], sizeof(f));
+        got = (long)f;
+      } else {
+        got = Y[i];
+      }
+      if (got != expect) errors++;
+    }
+    printf("%-5s %10.1f MB %12.6f s %12.6f s %10.3f GFLOP/s   %s\n",
+           type_names[type], ((double)n * n + n) * es * 1e-6, maxcomm, maxcomp,
+           2.0 * n * n / maxcomp * 1e-9, errors ? "WRONG" : "ok");
+  }
+
+  MPI_Type_free(&rowtype);
+  free(A);
+  free(x);
+  free(localA);
+  free(localY);
+  free(Y);
+  free(counts);
+  free(displs);
+}
+
+int main(int argc, char* argv[]) {
+  int t, np, me;
+  const int root = 0;         /* Root process in scatter */
+  long n;                     /* Matrix size */
+  int first = 0, last = NTYPES - 1;
+
+  MPI_Init(&argc, &argv);                /* Initialize MPI */
+  MPI_Comm_size(MPI_COMM_WORLD, &np);    /* Get nr of processes */
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);    /* Get own identifier */
+
+  n = (argc > 1) ? atol(argv[1]) : DEFAULT_N;
+  if (argc > 2) {
+    for (t = 0; t < NTYPES; t++) {
+      if (strcmp(argv[2], type_names[t]) == 0) first = last = t;
+    }
+  }
+  if (n < np || n > 2147483647L) {
+    if (me == root) printf("N must be between the number of processes and 2^31-1\n");
+    MPI_Finalize();
+    exit(0);
+  }
+
+  if (me == root) {
+    printf("Matrix-vector product of size %ld on %d processes\n", n, np);
+    printf("type       moved    distribute      compute              rate   check\n");
+  }
+  for (t = first; t <= last; t++) {
+    run(t, n, np, me, root);
+  }
+
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,165 @@
+/* An MPI program that adds two matrices, C = A + B (NxN integers).             */
+
+/* Process 0 initializes A and B and scatters the matching row blocks of both,  */
+/* so every process receives only the rows it adds and the whole addition      */
+/* moves 2 N^2 elements in and N^2 out, independent of the number of processes. */
+/* With 'local' the processes generate their own rows of A and B instead and   */
+/* only the result is gathered. Process 0 checks C against the exact value,    */
+/* prints a 4x4 corner of A, B and C and the number of bytes moved.            */
+/* This replaces the example in mpi-cluster-guide.md, which broadcast all of B */
+/* and added rows of B that belonged to process 0 on every process.            */
+
+/* Compile the program with 'mpicc -O2 matrix_add.c -o add'                    */
+/* Run the program with 'mpirun -np 4 add [N] [local]'                          */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpi.h"
+#include "matvec_kernels.h"
+#include "row_dist.h"
+
+#define NAMELEN 80   /* Max length of machine name */
+#define DEFAULT_N 8  /* Default matrix size N x N */
+#define SHOW 4       /* Corner of the matrices that is printed */
+
+/* Test data, below 1000 so that the sums stay far from int overflow */
+/* for any N                                                          */
+static int gen_a(long i, long j) { return (int)((i + j) % 1000); }
+static int gen_b(long i, long j) { return (int)((i * j) % 1000); }
+
+/* Print the SHOW x SHOW corner of an n x n matrix */
+static void show(const char *title, const int *M, long n) {
+  long i, j, k = n < SHOW ? n : SHOW;
+  printf("%s (showing %ldx%ld sample):\n", title, k, k);
+  for (i = 0; i < k; i++) {
+    for (j = 0; j < k; j++) {
+      printf("%3d ", M[i * n + j]);
+    }
+    printf("\n");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  int np, me, p;
+  const int root = 0;
+  char myname[NAMELEN];
+  long n = DEFAULT_N, rows, first, i, j, errors = 0;
+  int local = 0;
+  int *A = NULL, *B = NULL, *C = NULL;
+  int *localA, *localB, *localC;
+  int *counts = NULL, *displs = NULL;
+  double moved;
+  MPI_Datatype rowtype;
+
+  MPI_Init(&argc, &argv);                /* Initialize MPI */
+  MPI_Comm_size(MPI_COMM_WORLD, &np);    /* Get nr of processes */
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);    /* Get own identifier */
+
+  gethostname(myname, NAMELEN);    /* Get host name */
+
+  for (p = 1; p < argc; p++) {
+    if (strcmp(argv[p], "local") == 0) local = 1;
+    else n = atol(argv[p]);
+  }
+  if (n < 1 || n > 2147483647L) {
+    if (me == root) printf("Usage: add [N] [local], N between 1 and 2^31-1\n");
+    MPI_Finalize();
+    return 1;
+  }
+
+  rows = num_rows(n, np, me);
+  first = first_row(n, np, me);
+  localA = malloc((size_t)(rows > 0 ? rows : 1) * n * sizeof(int));
+  localB = malloc((size_t)(rows > 0 ? rows : 1) * n * sizeof(int));
+  localC = malloc((size_t)(rows > 0 ? rows : 1) * n * sizeof(int));
+  if (me == root) {
+    C = malloc((size_t)n * n * sizeof(int));
+    counts = malloc(np * sizeof(int));
+    displs = malloc(np * sizeof(int));
+    if (!local) {
+      A = malloc((size_t)n * n * sizeof(int));
+      B = malloc((size_t)n * n * sizeof(int));
+    }
+  }
+  if (localA == NULL || localB == NULL || localC == NULL ||
+      (me == root && (C == NULL || counts == NULL || displs == NULL ||
+                      (!local && (A == NULL || B == NULL))))) {
+    printf("Process %d on host %s: out of memory for N = %ld\n", me, myname, n);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  /* One row of the matrices is one element of rowtype */
+  MPI_Type_contiguous((int)n, MPI_INT, &rowtype);
+  MPI_Type_commit(&rowtype);
+
+  if (me == root) {
+    printf("Running on %d processes\n", np);
+    printf("Matrix Addition of size %ld, A and B %s\n", n,
+           local ? "generated on every process" : "scattered by row blocks");
+  }
+
+  if (local) {
+    /* Every process builds only its own rows */
+    for (i = 0; i < rows; i++) {
+      for (j = 0; j < n; j++) {
+        localA[i * n + j] = gen_a(first + i, j);
+        localB[i * n + j] = gen_b(first + i, j);
+      }
+    }
+  } else {
+    if (me == root) {
+      for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+          A[i * n + j] = gen_a(i, j);
+          B[i * n + j] = gen_b(i, j);
+        }
+      }
+      show("Matrix A", A, n);
+      show("Matrix B", B, n);
+    }
+    /* Both operands are scattered the same way, each process gets the */
+    /* rows of B that match its rows of A                              */
+    scatter_rows(A, localA, n, n * (long)sizeof(int), np, me, rowtype, root);
+    scatter_rows(B, localB, n, n * (long)sizeof(int), np, me, rowtype, root);
+  }
+
+  printf("Process %d on host %s adding rows %ld to %ld\n", me, myname, first, first + rows - 1);
+  vadd_i32(rows * n, localA, localB, localC);
+
+  if (me == root) {
+    for (p = 0; p < np; p++) {
+      counts[p] = (int)num_rows(n, np, p);
+      displs[p] = (int)first_row(n, np, p);
+    }
+  }
+  MPI_Gatherv(localC, (int)rows, rowtype, C, counts, displs, rowtype, root, MPI_COMM_WORLD);
+
+  if (me == root) {
+    for (i = 0; i < n; i++) {
+      for (j = 0; j < n; j++) {
+        if (C[i * n + j] != gen_a(i, j) + gen_b(i, j)) errors++;
+      }
+    }
+    show("Result Matrix C = A + B", C, n);
+    /* Rows that stay on root are not sent over the network */
+    moved = (double)(n - num_rows(n, np, root)) * n * sizeof(int) * (local ? 1 : 3);
+    printf("Matrix Addition of size %ld done, %ld wrong elements, %.0f bytes moved\n",
+           n, errors, moved);
+  }
+
+  MPI_Type_free(&rowtype);
+  free(localA);
+  free(localB);
+  free(localC);
+  if (me == root) {
+    free(A);
+    free(B);
+    free(C);
+    free(counts);
+    free(displs);
+  }
+  MPI_Finalize();
+  return 0;
+}
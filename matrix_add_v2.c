@@ -10,16 +10,175 @@
 /* Compile the program with 'mpicc mulscatter.c -o mulscatter'          */
 /* Run the program with 'mpirun -machinefile hostfile -np 4 mulscatter' */
 
+/* An optional argument selects how A and B are laid out:               */
+/*   separate    - A and B are scattered as two arrays (default)         */
+/*   interleaved - A and B are stored as {a,b} pairs, scattered once    */
+/*                 and added straight from the pairs                     */
+/*   inplace     - A and B are scattered separately and A += B is        */
+/*                 computed in place; process 0 also receives the sums   */
+/*                 of the others into A, so no sum buffer is used        */
+/* Adding 'bench' makes every process time the three layouts on a large */
+/* local array and report the streaming bandwidth; 'perf' additionally  */
+/* reads hardware counters around each of them (see perf_counters.h).   */
+/* The bandwidth test also places each layout on the roofline of the    */
+/* node (see roofline.h).                                                */
+/* Process 0 does not copy its own part of A, B or AB: it scatters with  */
+/* MPI_IN_PLACE and adds directly on the first elements of its arrays.   */
+/* Its only local buffer is one portion of sums, which also receives the */
+/* sums of the others, and none in place. The other processes allocate  */
+/* one portion of the buffers their layout uses.                         */
+
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "mpi.h"
+#include "matvec_kernels.h"
+#include "perf_counters.h"
+#include "roofline.h"
 #define MAXPROC 8    /* Max number of procsses */
 #define NAMELEN 80   /* Max length of machine name */
 #define LENGTH 48    /* Length of arrays A and B - 48 elements each */
 
+#define MODE_SEPARATE    0   /* A and B in separate arrays */
+#define MODE_INTERLEAVED 1   /* A and B as {a,b} pairs */
+#define MODE_INPLACE     2   /* A += B, no result buffer */
+
+#define BENCH_LENGTH (1 << 22)  /* Elements per array in the bandwidth test */
+#define BENCH_REPEAT 10         /* Timed passes per layout */
+
+const char *mode_names[] = { "separate", "interleaved", "inplace" };
+
+/* Scatter A and B from root in the selected layout and add the local    */
+/* portions. Only root's A, B and AB are read. Root passes A, B and AB  */
+/* themselves as its local portions, which are scattered with           */
+/* MPI_IN_PLACE and left where they are. Returns the local sums:        */
+/* localSum, or localA in place.                                        */
+int *scatter_add(int mode, int chunk, int me, int root, int *A, int *B, int *AB,
+                 int *localA, int *localB, int *localAB, int *localSum) {
+  int i;
+
+  switch (mode) {
+  case MODE_INTERLEAVED:
+    /* One scatter moves both operands */
+    MPI_Scatter(AB, 2*chunk, MPI_INT, me == root ? MPI_IN_PLACE : localAB, 2*chunk, MPI_INT, root, MPI_COMM_WORLD);
+    for (i=0; i<chunk; i++) {
+      localSum[i] = localAB[2*i] + localAB[2*i+1];
+    }
+    return localSum;
+  case MODE_INPLACE:
+    MPI_Scatter(A, chunk, MPI_INT, me == root ? MPI_IN_PLACE : localA, chunk, MPI_INT, root, MPI_COMM_WORLD);
+    MPI_Scatter(B, chunk, MPI_INT, me == root ? MPI_IN_PLACE : localB, chunk, MPI_INT, root, MPI_COMM_WORLD);
+    for (i=0; i<chunk; i++) {
+      localA[i] += localB[i];
+    }
+    return localA;
+  default:
+    MPI_Scatter(A, chunk, MPI_INT, me == root ? MPI_IN_PLACE : localA, chunk, MPI_INT, root, MPI_COMM_WORLD);
+    MPI_Scatter(B, chunk, MPI_INT, me == root ? MPI_IN_PLACE : localB, chunk, MPI_INT, root, MPI_COMM_WORLD);
+    vadd_i32(chunk, localA, localB, localSum);
+    return localSum;
+  }
+}
+
+/* Print the operands of a local portion, read from the layout they   */
+/* arrived in, and their sum. In place the sum has overwritten A.     */
+void print_portion(int mode, int chunk, const int *localA, const int *localB,
+                   const int *localAB, const int *sum) {
+  int i;
+  printf("  A elements:");
+  for (i=0; i<chunk; i++) {
+    if (mode == MODE_INTERLEAVED) printf(" %d", localAB[2*i]);
+    else if (mode == MODE_INPLACE) printf(" %d", sum[i] - localB[i]);
+    else printf(" %d", localA[i]);
+  }
+  printf("\n  B elements:");
+  for (i=0; i<chunk; i++) {
+    printf(" %d", mode == MODE_INTERLEAVED ? localAB[2*i+1] : localB[i]);
+  }
+  printf("\n  Sum elements:");
+  for (i=0; i<chunk; i++) {
+    printf(" %d", sum[i]);
+  }
+  printf("\n\n");
+}
+
+/* Time c = a + b, c = pair.a + pair.b and a += b over BENCH_LENGTH      */
+/* elements and print the bandwidth. 12 bytes are counted per element    */
+/* in all three cases, so the figures compare directly. With use_perf   */
+/* the hardware counters of each layout are printed as well.             */
+void stream_bench(int me, char *myname, int use_perf) {
+  int i, r, n = BENCH_LENGTH;
+  int *a = malloc(n * sizeof(int));
+  int *b = malloc(n * sizeof(int));
+  int *c = malloc(n * sizeof(int));
+  int *ab = malloc(2 * n * sizeof(int));
+  double t0, t[3], peak_bw, peak_flops;
+  perf_counters pc[3];
+
+  if (a == NULL || b == NULL || c == NULL || ab == NULL) {
+    printf("Process %d on host %s: out of memory for bandwidth test\n", me, myname);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  for (i=0; i<n; i++) {
+    a[i] = ab[2*i] = i;
+    b[i] = ab[2*i+1] = n - i;
+    c[i] = 0;
+  }
+
+  if (use_perf) {
+    for (r=0; r<3; r++) perf_open(&pc[r]);
+  }
+
+  t0 = MPI_Wtime();
+  if (use_perf) perf_start(&pc[MODE_SEPARATE]);
+  for (r=0; r<BENCH_REPEAT; r++) {
+    vadd_i32(n, a, b, c);
+  }
+  if (use_perf) perf_stop(&pc[MODE_SEPARATE]);
+  t[MODE_SEPARATE] = MPI_Wtime() - t0;
+
+  t0 = MPI_Wtime();
+  if (use_perf) perf_start(&pc[MODE_INTERLEAVED]);
+  for (r=0; r<BENCH_REPEAT; r++) {
+    for (i=0; i<n; i++) {
+      c[i] = ab[2*i] + ab[2*i+1];
+    }
+  }
+  if (use_perf) perf_stop(&pc[MODE_INTERLEAVED]);
+  t[MODE_INTERLEAVED] = MPI_Wtime() - t0;
+
+  t0 = MPI_Wtime();
+  if (use_perf) perf_start(&pc[MODE_INPLACE]);
+  for (r=0; r<BENCH_REPEAT; r++) {
+    vadd_i32(n, a, b, a);
+  }
+  if (use_perf) perf_stop(&pc[MODE_INPLACE]);
+  t[MODE_INPLACE] = MPI_Wtime() - t0;
+
+  for (r=0; r<3; r++) {
+    printf("Process %d on host %s: %-11s %8.2f GB/s\n", me, myname, mode_names[r],
+           3.0 * sizeof(int) * n * BENCH_REPEAT / t[r] * 1e-9);
+  }
+  if (use_perf) {
+    for (r=0; r<3; r++) {
+      perf_report(&pc[r], me, myname, mode_names[r]);
+      perf_close(&pc[r]);
+    }
+  }
+  roofline_peaks(&peak_bw, &peak_flops);
+  for (r=0; r<3; r++) {
+    roofline_report(me, myname, mode_names[r], (double)n * BENCH_REPEAT,
+                    3.0 * sizeof(int) * n * BENCH_REPEAT, t[r], peak_bw, peak_flops);
+  }
+  free(a); free(b); free(c); free(ab);
+}
+
 main(int argc, char* argv[]) {
   int i, j, np, me;
+  int mode = MODE_SEPARATE;   /* Layout of A and B */
+  int bench = 0;              /* Run the bandwidth test */
+  int use_perf = 0;           /* Hardware counters in the bandwidth test */
   const int nametag  = 42;    /* Tag value for sending name */
   const int datatag  = 43;    /* Tag value for sending data */
   const int root = 0;         /* Root process in scatter */
@@ -30,9 +189,13 @@ main(int argc, char* argv[]) {
 
   int A[LENGTH];            /* First array to distribute */
   int B[LENGTH];            /* Second array to distribute */
-  int localA[LENGTH];       /* Local portion of A */
-  int localB[LENGTH];       /* Local portion of B */
-  int localSum[LENGTH];     /* Local sum of A and B portions */
+  int AB[2*LENGTH];         /* A and B interleaved as {a,b} pairs */
+  int *localA = NULL;       /* Local portion of A, not on root */
+  int *localB = NULL;       /* Local portion of B, not on root */
+  int *localAB = NULL;      /* Local portion of AB, not on root */
+  int *localSum = NULL;     /* Local sum of A and B portions, not in place */
+  int *sum;                 /* Local sums, localSum or localA */
+  int chunk;                /* Elements per process */
 
   MPI_Init(&argc, &argv);                /* Initialize MPI */
   MPI_Comm_size(MPI_COMM_WORLD, &np);    /* Get nr of processes */
@@ -40,16 +203,28 @@ main(int argc, char* argv[]) {
   
   gethostname(myname, NAMELEN);    /* Get host name */
 
-  if (me == 0) {    /* Process 0 does this */
-    
-    /* Initialize the array A with values 0 .. LENGTH-1 */
-    for (i=0; i<LENGTH; i++) {
-      A[i] = i;
+  /* Select the layout and the tests */
+  for (j=1; j<argc; j++) {
+    for (i=0; i<3; i++) {
+      if (strcmp(argv[j], mode_names[i]) == 0) mode = i;
     }
+    if (strcmp(argv[j], "bench") == 0) bench = 1;
+    if (strcmp(argv[j], "perf") == 0) bench = use_perf = 1;
+  }
+
+  if (me == 0) {    /* Process 0 does this */
     
-    /* Initialize the array B with values LENGTH..2*LENGTH-1 */
+    /* Initialize the array A with values 0 .. LENGTH-1 and the array */
+    /* B with values LENGTH..2*LENGTH-1, as {a,b} pairs in AB for the */
+    /* interleaved layout                                             */
     for (i=0; i<LENGTH; i++) {
-      B[i] = LENGTH + i;
+      if (mode == MODE_INTERLEAVED) {
+        AB[2*i] = i;
+        AB[2*i+1] = LENGTH + i;
+      } else {
+        A[i] = i;
+        B[i] = LENGTH + i;
+      }
     }
 
     /* Check that we have valid number of processes */
@@ -60,42 +235,35 @@ main(int argc, char* argv[]) {
       exit(0);
     }
 
-    printf("Process %d on host %s is distributing arrays A and B to all %d processes\n\n", 
-           me, myname, np);
+    /* Root's own portions stay in A, B and AB; it only needs a buffer */
+    /* for the sums unless they are added into A in place              */
+    chunk = LENGTH/np;
+    if (mode != MODE_INPLACE && (localSum = malloc(chunk * sizeof(int))) == NULL) {
+      printf("Process %d on host %s: out of memory\n", me, myname);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
 
-    /* Scatter the arrays A and B to all processes */
-    MPI_Scatter(A, LENGTH/np, MPI_INT, localA, LENGTH/np, MPI_INT, root, MPI_COMM_WORLD);
-    MPI_Scatter(B, LENGTH/np, MPI_INT, localB, LENGTH/np, MPI_INT, root, MPI_COMM_WORLD);
+    printf("Process %d on host %s is distributing arrays A and B to all %d processes (%s layout)\n\n", 
+           me, myname, np, mode_names[mode]);
 
-    /* Add the local portions and store in localSum */
-    for (i=0; i<LENGTH/np; i++) {
-      localSum[i] = localA[i] + localB[i];
-    }
+    /* Scatter the arrays A and B to all processes and add the local portions; */
+    /* the own portions stay at the start of A, B and AB                       */
+    sum = scatter_add(mode, chunk, me, root, A, B, AB, A, B, AB, localSum);
 
     /* Print out own portion of the scattered arrays and their sum */
     printf("Process %d on host %s has:\n", me, myname);
-    printf("  A elements:");
-    for (i=0; i<LENGTH/np; i++) {
-      printf(" %d", localA[i]);
-    }
-    printf("\n  B elements:");
-    for (i=0; i<LENGTH/np; i++) {
-      printf(" %d", localB[i]);
-    }
-    printf("\n  Sum elements:");
-    for (i=0; i<LENGTH/np; i++) {
-      printf(" %d", localSum[i]);
-    }
-    printf("\n\n");
+    print_portion(mode, chunk, A, B, AB, sum);
 
-    /* Receive messages with hostname and the sums from all other processes */
+    /* Receive messages with hostname and the sums from all other processes; */
+    /* in place the sums go to their slices of A, which then holds A + B     */
     for (i=1; i<np; i++) {
+      int *recv = (mode == MODE_INPLACE) ? &A[i*chunk] : localSum;
       MPI_Recv(&hostname[i], NAMELEN, MPI_CHAR, i, nametag, MPI_COMM_WORLD, &status);
-      MPI_Recv(localSum, LENGTH/np, MPI_INT, i, datatag, MPI_COMM_WORLD, &status);
+      MPI_Recv(recv, chunk, MPI_INT, i, datatag, MPI_COMM_WORLD, &status);
       
       printf("Process %d on host %s has sum elements:", i, hostname[i]);
-      for (j=0; j<LENGTH/np; j++) {
-        printf(" %d", localSum[j]);
+      for (j=0; j<chunk; j++) {
+        printf(" %d", recv[j]);
       }
       printf("\n");
     }
@@ -110,42 +278,49 @@ main(int argc, char* argv[]) {
       exit(0);
     }
 
+    /* Buffers of one portion, only those the layout uses */
+    chunk = LENGTH/np;
+    if (mode == MODE_INTERLEAVED) {
+      localAB = malloc(2 * chunk * sizeof(int));
+    } else {
+      localA = malloc(chunk * sizeof(int));
+      localB = malloc(chunk * sizeof(int));
+    }
+    if (mode != MODE_INPLACE) localSum = malloc(chunk * sizeof(int));
+    if ((mode == MODE_INTERLEAVED && localAB == NULL) ||
+        (mode != MODE_INTERLEAVED && (localA == NULL || localB == NULL)) ||
+        (mode != MODE_INPLACE && localSum == NULL)) {
+      printf("Process %d on host %s: out of memory\n", me, myname);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
     printf("Process %d on host %s receiving scattered arrays\n", me, myname);
 
-    /* Receive the scattered arrays from process 0 */
-    MPI_Scatter(A, LENGTH/np, MPI_INT, localA, LENGTH/np, MPI_INT, root, MPI_COMM_WORLD);
-    MPI_Scatter(B, LENGTH/np, MPI_INT, localB, LENGTH/np, MPI_INT, root, MPI_COMM_WORLD);
-    
-    /* Add the local portions */
-    for (i=0; i<LENGTH/np; i++) {
-      localSum[i] = localA[i] + localB[i];
-    }
+    /* Receive the scattered arrays from process 0 and add the local portions */
+    sum = scatter_add(mode, chunk, me, root, A, B, AB, localA, localB, localAB, localSum);
     
     /* Print local data */
     printf("Process %d on host %s has:\n", me, myname);
-    printf("  A elements:");
-    for (i=0; i<LENGTH/np; i++) {
-      printf(" %d", localA[i]);
-    }
-    printf("\n  B elements:");
-    for (i=0; i<LENGTH/np; i++) {
-      printf(" %d", localB[i]);
-    }
-    printf("\n  Sum elements:");
-    for (i=0; i<LENGTH/np; i++) {
-      printf(" %d", localSum[i]);
-    }
-    printf("\n\n");
+    print_portion(mode, chunk, localA, localB, localAB, sum);
     
     /* Send own name back to process 0 */
     MPI_Send(myname, NAMELEN, MPI_CHAR, 0, nametag, MPI_COMM_WORLD);
     
     /* Send the calculated sum back to process 0 */
-    MPI_Send(localSum, LENGTH/np, MPI_INT, 0, datatag, MPI_COMM_WORLD);
+    MPI_Send(sum, chunk, MPI_INT, 0, datatag, MPI_COMM_WORLD);
     
     printf("Process %d on host %s has sent name and sum array back\n", me, myname);
   }
 
+  if (bench) {
+    stream_bench(me, myname, use_perf);
+  }
+
+  free(localA);
+  free(localB);
+  free(localAB);
+  free(localSum);
+
   MPI_Finalize();
   exit(0);
 }
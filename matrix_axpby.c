@@ -0,0 +1,169 @@
+/* An MPI program that computes C = alpha * A + beta * B for distributed NxN    */
+/* float matrices (addition, subtraction and scaling are special cases).        */
+
+/* The matrices are split over the processes in row blocks (-l rows, default)  */
+/* or in 2D blocks on a process grid (-l 2d), see dist_matrix.h. Process 0     */
+/* initializes A and B and sends every process its blocks, or with -L every    */
+/* process generates its own blocks. With -i the result overwrites B           */
+/* (B = alpha * A + beta * B) and no C is allocated. The result is left        */
+/* distributed and checked by every process on its own block, or with -g it is */
+/* gathered to process 0 and checked there. In both cases the norms, sum,     */
+/* minimum and maximum of the result are computed on the distributed blocks    */
+/* with one fused MPI_Allreduce (see dist_reduce.h).                           */
+
+/* Compile the program with 'mpicc -O2 matrix_axpby.c -o axpby'                */
+/* Run the program with                                                        */
+/*   'mpirun -np 4 axpby [-l rows|2d] [-a ALPHA] [-b BETA] [-i] [-L] [-g] [N]'  */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mpi.h"
+#include "dist_matrix.h"
+#include "dist_reduce.h"
+
+#define NAMELEN 80       /* Max length of machine name */
+#define DEFAULT_N 1024   /* Default matrix size N x N */
+
+/* Test data: small integers, exact in float */
+static float gen_a(long i, long j) { return (float)((i * 7 + j) % 100); }
+static float gen_b(long i, long j) { return (float)((i + j * 3) % 50); }
+
+/* Number of elements of the block starting at (row0, col0) that differ */
+/* from alpha * a + beta * b                                             */
+static long check(const float *C, long rows, long cols, long ld, long row0, long col0,
+                  float alpha, float beta) {
+  long i, j, errors = 0;
+  for (i = 0; i < rows; i++) {
+    for (j = 0; j < cols; j++) {
+      float want = alpha * gen_a(row0 + i, col0 + j) + beta * gen_b(row0 + i, col0 + j);
+      if (fabsf(C[i * ld + j] - want) > 1e-5f * (fabsf(want) + 1.0f)) errors++;
+    }
+  }
+  return errors;
+}
+
+int main(int argc, char* argv[]) {
+  int np, me, opt;
+  const int root = 0;
+  char myname[NAMELEN];
+  long n, errors, total = 0;
+  int layout = DIST_ROWS, in_place = 0, generate = 0, gather = 0;
+  float alpha = 1.0f, beta = 1.0f;
+  float *global = NULL;
+  dist_matrix A, B, C, *R;
+  double t0, t, tmax;
+  fused_reduce fr;
+  int snorm, sstat;
+  double fro, one, inf, sum, min, max;
+  long imin, imax;
+
+  MPI_Init(&argc, &argv);                /* Initialize MPI */
+  MPI_Comm_size(MPI_COMM_WORLD, &np);    /* Get nr of processes */
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);    /* Get own identifier */
+
+  gethostname(myname, NAMELEN);    /* Get host name */
+
+  while ((opt = getopt(argc, argv, "l:a:b:iLg")) != -1) {
+    switch (opt) {
+    case 'l': layout = strcmp(optarg, "2d") == 0 ? DIST_2D : DIST_ROWS; break;
+    case 'a': alpha = (float)atof(optarg); break;
+    case 'b': beta = (float)atof(optarg); break;
+    case 'i': in_place = 1; break;
+    case 'L': generate = 1; break;
+    case 'g': gather = 1; break;
+    default:
+      if (me == root) printf("Usage: axpby [-l rows|2d] [-a ALPHA] [-b BETA] [-i] [-L] [-g] [N]\n");
+      MPI_Finalize();
+      return 1;
+    }
+  }
+  n = (optind < argc) ? atol(argv[optind]) : DEFAULT_N;
+  if (n < 1) {
+    if (me == root) printf("N must be positive\n");
+    MPI_Finalize();
+    return 1;
+  }
+
+  if (dist_create(&A, n, n, layout) != 0 || dist_create(&B, n, n, layout) != 0 ||
+      (!in_place && dist_create(&C, n, n, layout) != 0)) {
+    printf("Process %d on host %s: out of memory for N = %ld\n", me, myname, n);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  if (me == root && (!generate || gather)) {
+    global = malloc((size_t)n * n * sizeof(float));
+    if (global == NULL) {
+      printf("Process %d on host %s: out of memory for N = %ld\n", me, myname, n);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
+  if (me == root) {
+    printf("C = %g * A + %g * B, N = %ld, %d processes as a %d x %d grid%s\n",
+           alpha, beta, n, np, A.pr, A.pc, in_place ? ", in place (B is overwritten)" : "");
+  }
+
+  if (generate) {
+    dist_generate(&A, gen_a);
+    dist_generate(&B, gen_b);
+  } else {
+    long i, j;
+    if (me == root) {
+      for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) global[i * n + j] = gen_a(i, j);
+      }
+    }
+    dist_scatter(&A, global, root);
+    if (me == root) {
+      for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) global[i * n + j] = gen_b(i, j);
+      }
+    }
+    dist_scatter(&B, global, root);
+  }
+
+  /* The operation itself needs no communication */
+  R = in_place ? &B : &C;
+  MPI_Barrier(MPI_COMM_WORLD);
+  t0 = MPI_Wtime();
+  dist_axpby(alpha, &A, beta, &B, R);
+  t = MPI_Wtime() - t0;
+  MPI_Reduce(&t, &tmax, 1, MPI_DOUBLE, MPI_MAX, root, MPI_COMM_WORLD);
+
+  printf("Process %d on host %s: block (%ld, %ld) of %ld x %ld\n",
+         me, myname, R->row0, R->col0, R->rows, R->cols);
+
+  /* Norms and statistics of the result in one reduction */
+  fr_init(&fr);
+  snorm = dist_norms_push(&fr, R);
+  sstat = dist_stats_push(&fr, R);
+  fr_allreduce(&fr, MPI_COMM_WORLD);
+  dist_norms_get(&fr, snorm, R, &fro, &one, &inf);
+  dist_stats_get(&fr, sstat, &sum, &min, &imin, &max, &imax);
+  fr_free(&fr);
+
+  if (gather) {
+    dist_gather(R, global, root);
+    if (me == root) total = check(global, n, n, n, 0, 0, alpha, beta);
+  } else {
+    errors = check(R->a, R->rows, R->cols, R->cols, R->row0, R->col0, alpha, beta);
+    MPI_Reduce(&errors, &total, 1, MPI_LONG, MPI_SUM, root, MPI_COMM_WORLD);
+  }
+
+  if (me == root) {
+    printf("Result %s, %ld wrong elements, local update %.6f s (%.2f GB/s per process)\n",
+           gather ? "gathered on process 0" : "left distributed", total, tmax,
+           tmax > 0.0 ? 3.0 * sizeof(float) * A.rows * A.cols / tmax * 1e-9 : 0.0);
+    printf("Frobenius norm %.6e, 1-norm %.6e, infinity norm %.6e\n", fro, one, inf);
+    printf("Sum %.6e, min %g at (%ld, %ld), max %g at (%ld, %ld)\n",
+           sum, min, imin / n, imin % n, max, imax / n, imax % n);
+  }
+
+  dist_free(&A);
+  dist_free(&B);
+  if (!in_place) dist_free(&C);
+  free(global);
+  MPI_Finalize();
+  return 0;
+}
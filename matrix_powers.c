@@ -0,0 +1,140 @@
+/* An MPI program that computes the Krylov basis x, A x, A^2 x, ..., A^s x for a */
+/* banded NxN matrix A distributed by row blocks, in two ways:                  */
+/*   standard      - s products, each with its own halo exchange of b entries  */
+/*                   per side (2s messages per process)                        */
+/*   matrix powers - one halo exchange of s * b entries per side, then s      */
+/*                   products on a shrinking region with redundant ghost rows  */
+/*                   (2 messages per process), see band_matrix.h               */
+/* Each process generates its own band rows. Process 0 checks that both give  */
+/* the same vectors and prints the time per basis of each and the extra rows  */
+/* the matrix powers kernel computes. On a high-latency network the s - 1     */
+/* saved round trips per side outweigh the extra work for small b.            */
+
+/* Compile the program with 'mpicc -O2 matrix_powers.c -o powers -lm'          */
+/* Run the program with 'mpirun -np 4 powers [-n N] [-b b] [-s s] [-r repeat]'  */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mpi.h"
+#include "band_matrix.h"
+
+#define NAMELEN 80       /* Max length of machine name */
+
+/* Test matrix with row sums near 1, so that A^k x stays bounded */
+static long half_band;
+static float gen_a(long i, long j) {
+  return (1.0f + (float)((i * 3 + j) % 5)) / (3.0f * (2 * half_band + 1));
+}
+
+int main(int argc, char* argv[]) {
+  int opt, np, me, k;
+  const int root = 0;
+  char myname[NAMELEN];       /* Local host name string */
+
+  long n = 100000;            /* Matrix size */
+  long b = 4;                 /* Half bandwidth */
+  int s = 4;                  /* Powers */
+  int repeat = 100;           /* Timed repetitions */
+
+  long i, rows, extra;
+  int r;
+  float *x, *xh, *V1, *V2, *work;
+  double t0, t_std, t_mpk, diff = 0.0, g[3];
+  band_matrix A;
+
+  MPI_Init(&argc, &argv);                /* Initialize MPI */
+  MPI_Comm_size(MPI_COMM_WORLD, &np);    /* Get nr of processes */
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);    /* Get own identifier */
+
+  gethostname(myname, NAMELEN);    /* Get host name */
+
+  while ((opt = getopt(argc, argv, "n:b:s:r:")) != -1) {
+    switch (opt) {
+    case 'n': n = atol(optarg); break;
+    case 'b': b = atol(optarg); break;
+    case 's': s = atoi(optarg); break;
+    case 'r': repeat = atoi(optarg); break;
+    default:
+      if (me == root) printf("Usage: powers [-n N] [-b b] [-s s] [-r repeat]\n");
+      MPI_Finalize();
+      exit(0);
+    }
+  }
+  if (b < 1 || s < 1 || repeat < 1 || num_rows(n, np, np - 1) < s * b) {
+    if (me == root) printf("Need b >= 1, s >= 1 and at least s * b rows per process\n");
+    MPI_Finalize();
+    exit(0);
+  }
+
+  half_band = b;
+  rows = num_rows(n, np, me);
+  if (band_create(&A, n, b, (s - 1) * b, gen_a) != 0) {
+    printf("Process %d on host %s: out of memory for N = %ld\n", me, myname, n);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  x = malloc(rows * sizeof(float));
+  xh = malloc((rows + 2 * b) * sizeof(float));
+  V1 = malloc((size_t)(s + 1) * rows * sizeof(float));
+  V2 = malloc((size_t)(s + 1) * rows * sizeof(float));
+  work = malloc((size_t)(s + 1) * (rows + 2 * s * b) * sizeof(float));
+  if (x == NULL || xh == NULL || V1 == NULL || V2 == NULL || work == NULL) {
+    printf("Process %d on host %s: out of memory for N = %ld\n", me, myname, n);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  for (i = 0; i < rows; i++) {
+    x[i] = 1.0f + (float)((A.first + i) % 3);
+  }
+
+  /* s products with a halo exchange each */
+  MPI_Barrier(MPI_COMM_WORLD);
+  t0 = MPI_Wtime();
+  for (r = 0; r < repeat; r++) {
+    memcpy(V1, x, rows * sizeof(float));
+    for (k = 1; k <= s; k++) {
+      memcpy(&xh[b], &V1[(k - 1) * rows], rows * sizeof(float));
+      band_matvec(&A, xh, &V1[k * rows]);
+    }
+  }
+  t_std = (MPI_Wtime() - t0) / repeat;
+
+  /* One deep halo exchange */
+  MPI_Barrier(MPI_COMM_WORLD);
+  t0 = MPI_Wtime();
+  for (r = 0; r < repeat; r++) {
+    band_powers(&A, s, x, V2, work);
+  }
+  t_mpk = (MPI_Wtime() - t0) / repeat;
+
+  for (i = 0; i < (s + 1) * rows; i++) {
+    double d = fabs(V1[i] - V2[i]) / (fabs(V1[i]) + 1e-30);
+    if (d > diff) diff = d;
+  }
+  g[0] = diff;
+  g[1] = t_std;
+  g[2] = t_mpk;
+  MPI_Reduce(me == root ? MPI_IN_PLACE : g, g, 3, MPI_DOUBLE, MPI_MAX, root, MPI_COMM_WORLD);
+
+  if (me == root) {
+    /* Rows computed beyond the own ones, per interior process and basis */
+    for (extra = 0, k = 1; k < s; k++) extra += 2 * (s - k) * b;
+    printf("Krylov basis of %d powers, N = %ld, half bandwidth %ld, %d processes\n", s, n, b, np);
+    printf("standard       %.6f s per basis, %d exchanges of %ld entries per side\n",
+           g[1], s, b);
+    printf("matrix powers  %.6f s per basis, 1 exchange of %ld entries per side, "
+           "%ld extra rows (%.1f%%)\n",
+           g[2], s * b, extra, 100.0 * extra / (s * (double)num_rows(n, np, 0)));
+    printf("Largest relative difference %.2e, speedup %.2f\n", g[0], g[1] / g[2]);
+  }
+
+  band_free(&A);
+  free(x);
+  free(xh);
+  free(V1);
+  free(V2);
+  free(work);
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,228 @@
+/* Local compute kernels shared by the matrix programs.                   */
+
+/* For the small fixed sizes that show up in the examples (16, 32, 64,    */
+/* 128) the kernels below are generated with the loop bound as a          */
+/* compile-time constant, so the compiler unrolls them completely and     */
+/* there is no loop overhead or remainder handling. The dispatch          */
+/* functions pick a specialized kernel when the dimension matches and     */
+/* fall back to a generic loop otherwise.                                 */
+
+#ifndef MATVEC_KERNELS_H
+#define MATVEC_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Generates dot_f32_NN() and add_i32_NN() for a fixed length NN.         */
+/* NN must be a multiple of 4, the dot product keeps 4 partial sums.      */
+#define MATVEC_FIXED_KERNELS(NN)                                          \
+static inline float dot_f32_##NN(const float *a, const float *x) {       \
+  float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;                       \
+  int j;                                                                  \
+  _Pragma("GCC unroll 128")                                               \
+  for (j = 0; j < NN; j += 4) {                                           \
+    s0 += a[j]   * x[j];                                                  \
+    s1 += a[j+1] * x[j+1];                                                \
+    s2 += a[j+2] * x[j+2];                                                \
+    s3 += a[j+3] * x[j+3];                                                \
+  }                                                                       \
+  return (s0 + s1) + (s2 + s3);                                           \
+}                                                                         \
+static inline void add_i32_##NN(const int *a, const int *b, int *c) {    \
+  int j;                                                                  \
+  _Pragma("GCC unroll 128")                                               \
+  for (j = 0; j < NN; j++) {                                              \
+    c[j] = a[j] + b[j];                                                   \
+  }                                                                       \
+}
+
+MATVEC_FIXED_KERNELS(16)
+MATVEC_FIXED_KERNELS(32)
+MATVEC_FIXED_KERNELS(64)
+MATVEC_FIXED_KERNELS(128)
+
+/* Generic fallback for any length */
+static inline float dot_f32(long n, const float *a, const float *x) {
+  float s = 0.0f;
+  long j;
+  for (j = 0; j < n; j++) {
+    s += a[j] * x[j];
+  }
+  return s;
+}
+
+/* y = A * x for a block of 'rows' rows of length n (row-major, lda = n). */
+/* Sizes are 64-bit so that rows * n may exceed 2^31.                     */
+static inline void matvec_f32(long rows, long n, const float *A,
+                              const float *x, float *y) {
+  long i;
+  switch (n) {
+  case 16:
+    for (i = 0; i < rows; i++) y[i] = dot_f32_16(&A[i * 16], x);
+    break;
+  case 32:
+    for (i = 0; i < rows; i++) y[i] = dot_f32_32(&A[i * 32], x);
+    break;
+  case 64:
+    for (i = 0; i < rows; i++) y[i] = dot_f32_64(&A[i * 64], x);
+    break;
+  case 128:
+    for (i = 0; i < rows; i++) y[i] = dot_f32_128(&A[i * 128], x);
+    break;
+  default:
+    for (i = 0; i < rows; i++) y[i] = dot_f32(n, &A[(size_t)i * n], x);
+    break;
+  }
+}
+
+/* Cache-blocked y = A * x. Rows are processed in blocks of rb rows,     */
+/* which are shared among 'threads' OpenMP threads when compiled with    */
+/* -fopenmp. Columns are processed in blocks of cb so that the slice of  */
+/* x in use stays in cache; cb >= n gives plain rows and keeps the       */
+/* fixed-size kernels above. The tuned values come from tuning.h.        */
+static inline void matvec_f32_blocked(long rows, long n, const float *A,
+                                      const float *x, float *y,
+                                      long rb, long cb, int threads) {
+  long ib;
+  if (rb < 1) rb = rows > 0 ? rows : 1;
+  if (cb < 1 || cb > n) cb = n;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static)
+#else
+  (void)threads;
+#endif
+  for (ib = 0; ib < rows; ib += rb) {
+    long i, jb, len = rows - ib < rb ? rows - ib : rb;
+    if (cb == n) {
+      matvec_f32(len, n, &A[(size_t)ib * n], x, &y[ib]);
+      continue;
+    }
+    for (i = ib; i < ib + len; i++) {
+      y[i] = 0.0f;
+    }
+    for (jb = 0; jb < n; jb += cb) {
+      long jlen = n - jb < cb ? n - jb : cb;
+      for (i = ib; i < ib + len; i++) {
+        y[i] += dot_f32(jlen, &A[(size_t)i * n + jb], &x[jb]);
+      }
+    }
+  }
+}
+
+/* c = a + b for n integers */
+static inline void vadd_i32(long n, const int *a, const int *b, int *c) {
+  long j;
+  switch (n) {
+  case 16:  add_i32_16(a, b, c);  break;
+  case 32:  add_i32_32(a, b, c);  break;
+  case 64:  add_i32_64(a, b, c);  break;
+  case 128: add_i32_128(a, b, c); break;
+  default:
+    for (j = 0; j < n; j++) {
+      c[j] = a[j] + b[j];
+    }
+    break;
+  }
+}
+
+/* c = alpha * a + beta * b for n floats. c may be a or b, which gives  */
+/* the in-place forms a = alpha * a + beta * b and b = ...              */
+static inline void axpby_f32(long n, float alpha, const float *a,
+                             float beta, const float *b, float *c) {
+  long j;
+  for (j = 0; j < n; j++) {
+    c[j] = alpha * a[j] + beta * b[j];
+  }
+}
+
+/* Low-precision storage. The integer kernels multiply int8 or int16     */
+/* values and accumulate in int32; written as plain widening loops so    */
+/* the compiler can use pmaddwd / VNNI dot-product instructions when     */
+/* built with -march=native. bfloat16 is stored as the upper 16 bits of  */
+/* a float and accumulated in float.                                     */
+static inline void matvec_i8(long rows, long n, const int8_t *A,
+                             const int8_t *x, int32_t *y) {
+  long i, j;
+  for (i = 0; i < rows; i++) {
+    const int8_t *a = &A[(size_t)i * n];
+    int32_t s = 0;
+    for (j = 0; j < n; j++) {
+      s += (int32_t)a[j] * (int32_t)x[j];
+    }
+    y[i] = s;
+  }
+}
+
+static inline void matvec_i16(long rows, long n, const int16_t *A,
+                              const int16_t *x, int32_t *y) {
+  long i, j;
+  for (i = 0; i < rows; i++) {
+    const int16_t *a = &A[(size_t)i * n];
+    int32_t s = 0;
+    for (j = 0; j < n; j++) {
+      s += (int32_t)a[j] * (int32_t)x[j];
+    }
+    y[i] = s;
+  }
+}
+
+static inline float bf16_to_f32(uint16_t h) {
+  uint32_t u = (uint32_t)h << 16;
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+/* Round to nearest even (NaN handling is not needed for our data) */
+static inline uint16_t f32_to_bf16(float f) {
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  u += 0x7fff + ((u >> 16) & 1);
+  return (uint16_t)(u >> 16);
+}
+
+static inline void matvec_bf16(long rows, long n, const uint16_t *A,
+                               const uint16_t *x, float *y) {
+  long i, j;
+  for (i = 0; i < rows; i++) {
+    const uint16_t *a = &A[(size_t)i * n];
+    float s = 0.0f;
+    for (j = 0; j < n; j++) {
+      s += bf16_to_f32(a[j]) * bf16_to_f32(x[j]);
+    }
+    y[i] = s;
+  }
+}
+
+/* Batched 16x16 matrix-vector products in interleaved layout.           */
+/* BATCH_LANES matrices form a tile, element (i,j) of all matrices in the */
+/* tile is stored contiguously: A[tile][i][j][lane], x[tile][j][lane],    */
+/* y[tile][i][lane]. The innermost loop runs over the lanes, so each SIMD */
+/* lane works on a different matrix and no horizontal sums are needed.    */
+#define BATCH_N     16
+#define BATCH_LANES 8
+
+static inline void matvec_f32_16_batched(long tiles, const float *A,
+                                         const float *x, float *y) {
+  long t;
+  int i, j, l;
+  for (t = 0; t < tiles; t++) {
+    const float *At = &A[t * BATCH_N * BATCH_N * BATCH_LANES];
+    const float *xt = &x[t * BATCH_N * BATCH_LANES];
+    float *yt = &y[t * BATCH_N * BATCH_LANES];
+    for (i = 0; i < BATCH_N; i++) {
+      float acc[BATCH_LANES] = {0};
+      for (j = 0; j < BATCH_N; j++) {
+        for (l = 0; l < BATCH_LANES; l++) {
+          acc[l] += At[(i * BATCH_N + j) * BATCH_LANES + l] * xt[j * BATCH_LANES + l];
+        }
+      }
+      for (l = 0; l < BATCH_LANES; l++) {
+        yt[i * BATCH_LANES + l] = acc[l];
+      }
+    }
+  }
+}
+
+#endif /* MATVEC_KERNELS_H */
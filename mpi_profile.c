@@ -0,0 +1,322 @@
+/* A PMPI profiling library for the MPI programs in this directory.            */
+/* It wraps the MPI calls used by the programs through the PMPI interface and  */
+/* records, per rank and per call site, the number of calls, the bytes moved   */
+/* by this rank and the time spent in the call. At MPI_Finalize the tables of  */
+/* all ranks are collected on rank 0 and printed, most expensive first.        */
+
+/* Bytes are the data this rank sends or receives: for rooted collectives the  */
+/* root counts all blocks, the other ranks their own block. For nonblocking    */
+/* calls the time is the time to post, the rest shows up in MPI_Wait.          */
+/* Call sites are printed as function+offset when the program is linked with  */
+/* -rdynamic, and always as binary+offset for 'addr2line -e binary offset'.    */
+
+/* Build the library with                                                      */
+/*   'mpicc -O2 -shared -fPIC mpi_profile.c -o libmpiprof.so -ldl'             */
+/* Profile a program without rebuilding it with                                */
+/*   'mpirun -np 4 -x LD_PRELOAD=$PWD/libmpiprof.so mult'                      */
+/* Set MPIPROF_OUT=file to write the report to a file instead of stdout.       */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpi.h"
+
+#define MAXSITES 1024        /* Call sites recorded per rank (power of two) */
+#define LINELEN 256          /* Length of one report line */
+
+enum { F_SEND, F_RECV, F_BCAST, F_SCATTER, F_SCATTERV, F_GATHER, F_GATHERV,
+       F_ALLGATHER, F_ALLGATHERV, F_REDUCE, F_ALLREDUCE, F_ALLTOALLV,
+       F_BARRIER, F_ISCATTERV, F_IALLREDUCE, F_WAIT, NFUNCS };
+
+static const char *func_names[NFUNCS] = {
+  "MPI_Send", "MPI_Recv", "MPI_Bcast", "MPI_Scatter", "MPI_Scatterv",
+  "MPI_Gather", "MPI_Gatherv", "MPI_Allgather", "MPI_Allgatherv",
+  "MPI_Reduce", "MPI_Allreduce", "MPI_Alltoallv", "MPI_Barrier",
+  "MPI_Iscatterv", "MPI_Iallreduce", "MPI_Wait"
+};
+
+typedef struct {
+  void *site;                 /* Return address in the caller, NULL = free */
+  int func;
+  long calls;
+  double bytes;
+  double time;
+} site_stats;
+
+static site_stats sites[MAXSITES];
+static int dropped = 0;       /* Calls that did not fit in the table */
+
+static void record(int func, void *site, double bytes, double time) {
+  size_t h = (((size_t)site >> 2) * 31 + func) & (MAXSITES - 1);
+  int probe;
+  for (probe = 0; probe < MAXSITES; probe++) {
+    site_stats *s = &sites[(h + probe) & (MAXSITES - 1)];
+    if (s->site == NULL) {
+      s->site = site;
+      s->func = func;
+    }
+    if (s->site == site && s->func == func) {
+      s->calls++;
+      s->bytes += bytes;
+      s->time += time;
+      return;
+    }
+  }
+  dropped++;
+}
+
+static double type_bytes(int count, MPI_Datatype type) {
+  int size;
+  PMPI_Type_size(type, &size);
+  return (double)count * size;
+}
+
+static int comm_size(MPI_Comm comm) {
+  int np;
+  PMPI_Comm_size(comm, &np);
+  return np;
+}
+
+static int comm_rank(MPI_Comm comm) {
+  int me;
+  PMPI_Comm_rank(comm, &me);
+  return me;
+}
+
+static double sum_counts(const int *counts, MPI_Datatype type, MPI_Comm comm) {
+  int p, np = comm_size(comm);
+  double total = 0.0;
+  for (p = 0; p < np; p++) {
+    total += type_bytes(counts[p], type);
+  }
+  return total;
+}
+
+/* Wrap one call: time it and record it under the caller's address */
+#define PROFILE(func, bytes, call)                                      \
+  do {                                                                  \
+    double t0 = PMPI_Wtime();                                           \
+    int rc = call;                                                      \
+    record(func, __builtin_return_address(0), bytes, PMPI_Wtime() - t0); \
+    return rc;                                                          \
+  } while (0)
+
+int MPI_Send(const void *buf, int count, MPI_Datatype type, int dest, int tag,
+             MPI_Comm comm) {
+  PROFILE(F_SEND, type_bytes(count, type),
+          PMPI_Send(buf, count, type, dest, tag, comm));
+}
+
+int MPI_Recv(void *buf, int count, MPI_Datatype type, int source, int tag,
+             MPI_Comm comm, MPI_Status *status) {
+  PROFILE(F_RECV, type_bytes(count, type),
+          PMPI_Recv(buf, count, type, source, tag, comm, status));
+}
+
+int MPI_Bcast(void *buf, int count, MPI_Datatype type, int root, MPI_Comm comm) {
+  PROFILE(F_BCAST, type_bytes(count, type),
+          PMPI_Bcast(buf, count, type, root, comm));
+}
+
+int MPI_Scatter(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                int root, MPI_Comm comm) {
+  PROFILE(F_SCATTER,
+          comm_rank(comm) == root ? type_bytes(sendcount, sendtype) * comm_size(comm)
+                                  : type_bytes(recvcount, recvtype),
+          PMPI_Scatter(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype,
+                       root, comm));
+}
+
+int MPI_Scatterv(const void *sendbuf, const int *sendcounts, const int *displs,
+                 MPI_Datatype sendtype, void *recvbuf, int recvcount,
+                 MPI_Datatype recvtype, int root, MPI_Comm comm) {
+  PROFILE(F_SCATTERV,
+          comm_rank(comm) == root ? sum_counts(sendcounts, sendtype, comm)
+                                  : type_bytes(recvcount, recvtype),
+          PMPI_Scatterv(sendbuf, sendcounts, displs, sendtype, recvbuf, recvcount,
+                        recvtype, root, comm));
+}
+
+int MPI_Gather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+               void *recvbuf, int recvcount, MPI_Datatype recvtype,
+               int root, MPI_Comm comm) {
+  PROFILE(F_GATHER,
+          comm_rank(comm) == root ? type_bytes(recvcount, recvtype) * comm_size(comm)
+                                  : type_bytes(sendcount, sendtype),
+          PMPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype,
+                      root, comm));
+}
+
+int MPI_Gatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                void *recvbuf, const int *recvcounts, const int *displs,
+                MPI_Datatype recvtype, int root, MPI_Comm comm) {
+  PROFILE(F_GATHERV,
+          comm_rank(comm) == root ? sum_counts(recvcounts, recvtype, comm)
+                                  : type_bytes(sendcount, sendtype),
+          PMPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs,
+                       recvtype, root, comm));
+}
+
+int MPI_Allgather(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                  void *recvbuf, int recvcount, MPI_Datatype recvtype,
+                  MPI_Comm comm) {
+  PROFILE(F_ALLGATHER, type_bytes(recvcount, recvtype) * comm_size(comm),
+          PMPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount,
+                         recvtype, comm));
+}
+
+int MPI_Allgatherv(const void *sendbuf, int sendcount, MPI_Datatype sendtype,
+                   void *recvbuf, const int *recvcounts, const int *displs,
+                   MPI_Datatype recvtype, MPI_Comm comm) {
+  PROFILE(F_ALLGATHERV, sum_counts(recvcounts, recvtype, comm),
+          PMPI_Allgatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts,
+                          displs, recvtype, comm));
+}
+
+int MPI_Reduce(const void *sendbuf, void *recvbuf, int count, MPI_Datatype type,
+               MPI_Op op, int root, MPI_Comm comm) {
+  PROFILE(F_REDUCE, type_bytes(count, type),
+          PMPI_Reduce(sendbuf, recvbuf, count, type, op, root, comm));
+}
+
+int MPI_Allreduce(const void *sendbuf, void *recvbuf, int count, MPI_Datatype type,
+                  MPI_Op op, MPI_Comm comm) {
+  PROFILE(F_ALLREDUCE, type_bytes(count, type),
+          PMPI_Allreduce(sendbuf, recvbuf, count, type, op, comm));
+}
+
+int MPI_Alltoallv(const void *sendbuf, const int *sendcounts, const int *sdispls,
+                  MPI_Datatype sendtype, void *recvbuf, const int *recvcounts,
+                  const int *rdispls, MPI_Datatype recvtype, MPI_Comm comm) {
+  PROFILE(F_ALLTOALLV, sum_counts(sendcounts, sendtype, comm),
+          PMPI_Alltoallv(sendbuf, sendcounts, sdispls, sendtype, recvbuf,
+                         recvcounts, rdispls, recvtype, comm));
+}
+
+int MPI_Barrier(MPI_Comm comm) {
+  PROFILE(F_BARRIER, 0.0, PMPI_Barrier(comm));
+}
+
+int MPI_Iscatterv(const void *sendbuf, const int sendcounts[], const int displs[],
+                  MPI_Datatype sendtype, void *recvbuf, int recvcount,
+                  MPI_Datatype recvtype, int root, MPI_Comm comm,
+                  MPI_Request *request) {
+  PROFILE(F_ISCATTERV,
+          comm_rank(comm) == root ? sum_counts(sendcounts, sendtype, comm)
+                                  : type_bytes(recvcount, recvtype),
+          PMPI_Iscatterv(sendbuf, sendcounts, displs, sendtype, recvbuf,
+                         recvcount, recvtype, root, comm, request));
+}
+
+int MPI_Iallreduce(const void *sendbuf, void *recvbuf, int count, MPI_Datatype type,
+                   MPI_Op op, MPI_Comm comm, MPI_Request *request) {
+  PROFILE(F_IALLREDUCE, type_bytes(count, type),
+          PMPI_Iallreduce(sendbuf, recvbuf, count, type, op, comm, request));
+}
+
+int MPI_Wait(MPI_Request *request, MPI_Status *status) {
+  PROFILE(F_WAIT, 0.0, PMPI_Wait(request, status));
+}
+
+static int by_time(const void *a, const void *b) {
+  const site_stats *x = a, *y = b;
+  return (x->time < y->time) - (x->time > y->time);
+}
+
+/* Length of a line that snprintf wanted to write at text + pos with */
+/* size LINELEN; a truncated line is cut to LINELEN - 1 bytes ending  */
+/* in a newline, so each line stays within its LINELEN of the buffer */
+static int line_length(char *text, int pos, int w) {
+  if (w < 0) return 0;
+  if (w > LINELEN - 1) {
+    w = LINELEN - 1;
+    text[pos + w - 1] = '\n';
+  }
+  return w;
+}
+
+/* Format this rank's table into a malloc'ed text buffer */
+static char *format_report(int me, int *len) {
+  site_stats used[MAXSITES];
+  int i, n = 0, pos = 0;
+  char *text;
+
+  for (i = 0; i < MAXSITES; i++) {
+    if (sites[i].site != NULL) used[n++] = sites[i];
+  }
+  qsort(used, n, sizeof(site_stats), by_time);
+
+  text = malloc((size_t)(n + 2) * LINELEN);
+  for (i = 0; i < n; i++) {
+    Dl_info info;
+    char where[LINELEN];
+    if (dladdr(used[i].site, &info) && info.dli_fname != NULL) {
+      const char *bin = strrchr(info.dli_fname, '/');
+      bin = bin ? bin + 1 : info.dli_fname;
+      if (info.dli_sname != NULL) {
+        snprintf(where, sizeof(where), "%s+0x%lx (%s+0x%lx)", info.dli_sname,
+                 (unsigned long)((char *)used[i].site - (char *)info.dli_saddr),
+                 bin, (unsigned long)((char *)used[i].site - (char *)info.dli_fbase));
+      } else {
+        snprintf(where, sizeof(where), "%s+0x%lx", bin,
+                 (unsigned long)((char *)used[i].site - (char *)info.dli_fbase));
+      }
+    } else {
+      snprintf(where, sizeof(where), "%p", used[i].site);
+    }
+    pos += line_length(text, pos,
+                       snprintf(text + pos, LINELEN, "%4d  %-15s %8ld %14.0f %12.6f  %s\n",
+                                me, func_names[used[i].func], used[i].calls, used[i].bytes,
+                                used[i].time, where));
+  }
+  if (dropped > 0) {
+    pos += line_length(text, pos,
+                       snprintf(text + pos, LINELEN, "%4d  %d calls not recorded, table full\n",
+                                me, dropped));
+  }
+  *len = pos;
+  return text;
+}
+
+int MPI_Finalize(void) {
+  int me, np, p, len, total = 0;
+  int *lens = NULL, *displs = NULL;
+  char *text, *all = NULL;
+
+  PMPI_Comm_rank(MPI_COMM_WORLD, &me);
+  PMPI_Comm_size(MPI_COMM_WORLD, &np);
+  text = format_report(me, &len);
+
+  if (me == 0) {
+    lens = malloc(np * sizeof(int));
+    displs = malloc(np * sizeof(int));
+  }
+  PMPI_Gather(&len, 1, MPI_INT, lens, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (me == 0) {
+    for (p = 0; p < np; p++) {
+      displs[p] = total;
+      total += lens[p];
+    }
+    all = malloc(total + 1);
+  }
+  PMPI_Gatherv(text, len, MPI_CHAR, all, lens, displs, MPI_CHAR, 0, MPI_COMM_WORLD);
+
+  if (me == 0) {
+    const char *name = getenv("MPIPROF_OUT");
+    FILE *out = name ? fopen(name, "w") : stdout;
+    if (out == NULL) out = stdout;
+    all[total] = '\0';
+    fprintf(out, "\nMPI profile (%d ranks)\n", np);
+    fprintf(out, "rank  call               calls          bytes     time [s]  call site\n");
+    fputs(all, out);
+    if (out != stdout) fclose(out);
+    free(lens);
+    free(displs);
+    free(all);
+  }
+  free(text);
+  return PMPI_Finalize();
+}
@@ -0,0 +1,237 @@
+/* Reordering and partitioning of a sparse matrix for the row-block     */
+/* distribution of csr_matrix.h.                                        */
+
+/* All functions run on the process that holds the whole matrix and    */
+/* treat the sparsity pattern as an undirected graph (row i is linked   */
+/* to every column j with a(i,j) != 0, so the pattern should be         */
+/* symmetric). Each returns a permutation perm (new row k is old row    */
+/* perm[k]) and np + 1 block starts in the new numbering:               */
+/*   rcm    - reverse Cuthill-McKee ordering, which gathers the matrix   */
+/*            around the diagonal, cut into blocks of equal nonzeros    */
+/*   bisect - recursive graph bisection: the vertices of a part are     */
+/*            ordered by breadth-first search from a pseudo-peripheral  */
+/*            vertex and split where the nonzeros reach the share of    */
+/*            the first half of the processes                            */
+/*   metis  - METIS_PartGraphKway, when built with -DHAVE_METIS -lmetis */
+/* Within a part the rows keep their search order, so that the halo    */
+/* entries also come out grouped.                                       */
+
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "csr_matrix.h"
+#ifdef HAVE_METIS
+#include <metis.h>
+#endif
+
+#define PART_NONE   0
+#define PART_RCM    1
+#define PART_BISECT 2
+#define PART_METIS  3
+
+static long part_degree(const csr_matrix *G, long v) {
+  return G->rowptr[v + 1] - G->rowptr[v];
+}
+
+/* Breadth-first search from 'start' over the vertices with mark[v] ==  */
+/* tag, appending them to order[] and setting their mark to tag + 1.    */
+/* With 'by_degree' the neighbours are visited in increasing degree     */
+/* (Cuthill-McKee). Returns the number of vertices reached.             */
+static long part_bfs(const csr_matrix *G, int *mark, int tag, long start,
+                     long *order, int by_degree) {
+  long head = 0, tail = 0, k, a, b;
+
+  order[tail++] = start;
+  mark[start] = tag + 1;
+  while (head < tail) {
+    long v = order[head++], first = tail;
+    for (k = G->rowptr[v]; k < G->rowptr[v + 1]; k++) {
+      long w = G->col[k];
+      if (mark[w] == tag) {
+        mark[w] = tag + 1;
+        order[tail++] = w;
+      }
+    }
+    if (by_degree) {
+      /* Insertion sort of the new vertices, there are few */
+      for (a = first + 1; a < tail; a++) {
+        long w = order[a];
+        for (b = a; b > first && part_degree(G, order[b - 1]) > part_degree(G, w); b--) {
+          order[b] = order[b - 1];
+        }
+        order[b] = w;
+      }
+    }
+  }
+  return tail;
+}
+
+/* A vertex far from the others of its set: start at 'v', go to the    */
+/* last vertex of a search, twice. mark[] is restored to tag.           */
+static long part_peripheral(const csr_matrix *G, int *mark, int tag, long v, long *tmp) {
+  long r, i, cnt;
+  for (r = 0; r < 2; r++) {
+    cnt = part_bfs(G, mark, tag, v, tmp, 0);
+    v = tmp[cnt - 1];
+    for (i = 0; i < cnt; i++) mark[tmp[i]] = tag;
+  }
+  return v;
+}
+
+/* Order the 'cnt' vertices of list[] (all with mark == tag) by search */
+/* from pseudo-peripheral vertices, one search per connected piece.    */
+static void part_order(const csr_matrix *G, int *mark, int tag, long *list, long cnt,
+                       long *tmp, int by_degree) {
+  long i, done = 0, *out = malloc((cnt > 0 ? cnt : 1) * sizeof(long));
+  for (i = 0; i < cnt; i++) {
+    if (mark[list[i]] != tag) continue;
+    done += part_bfs(G, mark, tag, part_peripheral(G, mark, tag, list[i], tmp),
+                     &out[done], by_degree);
+  }
+  memcpy(list, out, cnt * sizeof(long));
+  free(out);
+}
+
+/* Block starts in the order perm with about equal nonzeros per block */
+static void part_split(const csr_matrix *G, const long *perm, int np, long *starts) {
+  long k, acc = 0;
+  int p = 1;
+  starts[0] = 0;
+  for (k = 0; k < G->n && p < np; k++) {
+    acc += part_degree(G, perm[k]);
+    while (p < np && acc * np >= G->nnz * (long)p) starts[p++] = k + 1;
+  }
+  while (p <= np) starts[p++] = G->n;
+}
+
+static inline void part_rcm(const csr_matrix *G, int np, long *perm, long *starts) {
+  long i, n = G->n;
+  int *mark = calloc(n, sizeof(int));
+  long *tmp = malloc(n * sizeof(long));
+
+  for (i = 0; i < n; i++) perm[i] = i;
+  part_order(G, mark, 0, perm, n, tmp, 1);
+  for (i = 0; i < n / 2; i++) {       /* reverse */
+    long t = perm[i];
+    perm[i] = perm[n - 1 - i];
+    perm[n - 1 - i] = t;
+  }
+  part_split(G, perm, np, starts);
+  free(mark);
+  free(tmp);
+}
+
+/* Split list[0..cnt) over processes p0..p0+nparts-1 */
+static void part_bisect_rec(const csr_matrix *G, int *mark, long *list, long cnt,
+                            int p0, int nparts, long offset, long *starts, long *tmp) {
+  static int tag = 0;
+  long i, nnz = 0, acc = 0, cut = 0;
+  int left = nparts / 2;
+
+  if (nparts == 1) {
+    starts[p0] = offset;
+    return;
+  }
+  tag += 2;
+  for (i = 0; i < cnt; i++) {
+    mark[list[i]] = tag;
+    nnz += part_degree(G, list[i]);
+  }
+  part_order(G, mark, tag, list, cnt, tmp, 0);
+  while (cut < cnt && acc * nparts < nnz * (long)left) acc += part_degree(G, list[cut++]);
+  part_bisect_rec(G, mark, list, cut, p0, left, offset, starts, tmp);
+  part_bisect_rec(G, mark, list + cut, cnt - cut, p0 + left, nparts - left,
+                  offset + cut, starts, tmp);
+}
+
+static inline void part_bisect(const csr_matrix *G, int np, long *perm, long *starts) {
+  long i, n = G->n;
+  int *mark = calloc(n, sizeof(int));
+  long *tmp = malloc(n * sizeof(long));
+
+  for (i = 0; i < n; i++) perm[i] = i;
+  part_bisect_rec(G, mark, perm, n, 0, np, 0, starts, tmp);
+  starts[np] = n;
+  free(mark);
+  free(tmp);
+}
+
+/* Permutation and starts from a part number per vertex, stable */
+static void part_from_labels(long n, int np, const int *part, long *perm, long *starts) {
+  long i;
+  int p;
+  long *next = calloc(np + 1, sizeof(long));
+  for (i = 0; i < n; i++) next[part[i] + 1]++;
+  for (p = 0; p < np; p++) next[p + 1] += next[p];
+  memcpy(starts, next, (np + 1) * sizeof(long));
+  for (i = 0; i < n; i++) perm[next[part[i]]++] = i;
+  free(next);
+}
+
+/* Returns 0, or -1 when METIS is not built in */
+static inline int part_metis(const csr_matrix *G, int np, long *perm, long *starts) {
+#ifdef HAVE_METIS
+  idx_t nv = (idx_t)G->n, ncon = 1, nparts = np, objval, i, k, e = 0;
+  idx_t *xadj = malloc((G->n + 1) * sizeof(idx_t));
+  idx_t *adj = malloc((G->nnz > 0 ? G->nnz : 1) * sizeof(idx_t));
+  idx_t *part = malloc(G->n * sizeof(idx_t));
+  idx_t *vwgt = malloc(G->n * sizeof(idx_t));
+  int *labels = malloc(G->n * sizeof(int));
+
+  /* METIS wants no self loops; weight vertices by their nonzeros */
+  for (i = 0; i < nv; i++) {
+    xadj[i] = e;
+    vwgt[i] = (idx_t)part_degree(G, i);
+    for (k = G->rowptr[i]; k < G->rowptr[i + 1]; k++) {
+      if (G->col[k] != i) adj[e++] = (idx_t)G->col[k];
+    }
+  }
+  xadj[nv] = e;
+  if (np > 1) {
+    METIS_PartGraphKway(&nv, &ncon, xadj, adj, vwgt, NULL, NULL, &nparts,
+                        NULL, NULL, NULL, &objval, part);
+  } else {
+    for (i = 0; i < nv; i++) part[i] = 0;
+  }
+  for (i = 0; i < nv; i++) labels[i] = (int)part[i];
+  part_from_labels(G->n, np, labels, perm, starts);
+  free(xadj);
+  free(adj);
+  free(part);
+  free(vwgt);
+  free(labels);
+  return 0;
+#else
+  (void)G; (void)np; (void)perm; (void)starts;
+  (void)part_from_labels;
+  return -1;
+#endif
+}
+
+/* P = A with rows and columns renumbered: row k of P is row perm[k]    */
+/* of A, column j of A becomes column inv[j]. Returns 0 or -1.          */
+static inline int csr_permute(const csr_matrix *A, const long *perm, csr_matrix *P) {
+  long i, k, e = 0;
+  long *inv = malloc(A->n * sizeof(long));
+
+  if (inv == NULL || csr_alloc(P, A->n, A->n, 0, A->nnz) != 0) {
+    free(inv);
+    return -1;
+  }
+  for (i = 0; i < A->n; i++) inv[perm[i]] = i;
+  for (i = 0; i < A->n; i++) {
+    long r = perm[i];
+    P->rowptr[i] = e;
+    for (k = A->rowptr[r]; k < A->rowptr[r + 1]; k++, e++) {
+      P->col[e] = inv[A->col[k]];
+      P->val[e] = A->val[k];
+    }
+  }
+  P->rowptr[A->n] = e;
+  free(inv);
+  return 0;
+}
+
+#endif /* PARTITION_H */
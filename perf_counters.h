@@ -0,0 +1,138 @@
+/* Hardware counters around compute kernels via perf_event_open.         */
+
+/* Every counter is opened on its own for the calling thread, user mode  */
+/* only, so one that the CPU or hypervisor does not expose does not stop */
+/* the others. VirtualBox often exposes no PMU at all; the report then   */
+/* shows n/a for the hardware counters and only the task clock remains.  */
+/* The floating point counters use the Intel FP_ARITH_INST_RETIRED raw   */
+/* events (Skylake and later) and are only tried on Intel CPUs. From     */
+/* them the single precision FLOPs and the share of SIMD instructions    */
+/* are derived, which shows whether the vectorized kernels are running.  */
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+
+enum { PC_TASK_CLOCK, PC_CYCLES, PC_INSTRUCTIONS, PC_LLC_MISSES,
+       PC_FP_SCALAR, PC_FP_128, PC_FP_256, PC_NCOUNTERS };
+
+typedef struct {
+  int fd[PC_NCOUNTERS];       /* -1 when the counter is not available */
+  long long value[PC_NCOUNTERS];
+} perf_counters;
+
+static int perf_is_intel(void) {
+  char line[256];
+  int intel = 0;
+  FILE *f = fopen("/proc/cpuinfo", "r");
+  if (f == NULL) return 0;
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (strncmp(line, "vendor_id", 9) == 0) {
+      intel = (strstr(line, "GenuineIntel") != NULL);
+      break;
+    }
+  }
+  fclose(f);
+  return intel;
+}
+
+static int perf_open_one(unsigned type, unsigned long long config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Open all counters that are available; returns how many hardware      */
+/* counters could be opened                                              */
+static inline int perf_open(perf_counters *pc) {
+  int i, hw = 0;
+  memset(pc->value, 0, sizeof(pc->value));
+  pc->fd[PC_TASK_CLOCK]   = perf_open_one(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+  pc->fd[PC_CYCLES]       = perf_open_one(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  pc->fd[PC_INSTRUCTIONS] = perf_open_one(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+  pc->fd[PC_LLC_MISSES]   = perf_open_one(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+  pc->fd[PC_FP_SCALAR] = pc->fd[PC_FP_128] = pc->fd[PC_FP_256] = -1;
+  if (perf_is_intel()) {
+    pc->fd[PC_FP_SCALAR] = perf_open_one(PERF_TYPE_RAW, 0x02c7);  /* scalar single */
+    pc->fd[PC_FP_128]    = perf_open_one(PERF_TYPE_RAW, 0x08c7);  /* 128-bit packed single */
+    pc->fd[PC_FP_256]    = perf_open_one(PERF_TYPE_RAW, 0x20c7);  /* 256-bit packed single */
+  }
+  for (i = PC_CYCLES; i < PC_NCOUNTERS; i++) {
+    if (pc->fd[i] >= 0) hw++;
+  }
+  return hw;
+}
+
+static inline void perf_start(perf_counters *pc) {
+  int i;
+  for (i = 0; i < PC_NCOUNTERS; i++) {
+    if (pc->fd[i] >= 0) {
+      ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+}
+
+/* Stop counting and add the counts to pc->value */
+static inline void perf_stop(perf_counters *pc) {
+  int i;
+  long long v;
+  for (i = 0; i < PC_NCOUNTERS; i++) {
+    if (pc->fd[i] >= 0) {
+      ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+      if (read(pc->fd[i], &v, sizeof(v)) == sizeof(v)) pc->value[i] += v;
+    }
+  }
+}
+
+static inline void perf_close(perf_counters *pc) {
+  int i;
+  for (i = 0; i < PC_NCOUNTERS; i++) {
+    if (pc->fd[i] >= 0) close(pc->fd[i]);
+    pc->fd[i] = -1;
+  }
+}
+
+/* Print one line per call: IPC and LLC misses per 1000 instructions     */
+/* tell compute-bound (high IPC, few misses) from memory-bound kernels.  */
+static inline void perf_report(const perf_counters *pc, int me, const char *host,
+                               const char *kernel) {
+  const long long *v = pc->value;
+  char cycles[32] = "n/a", instr[32] = "n/a";
+  char ipc[32] = "n/a", mpki[32] = "n/a", flops[32] = "n/a", simd[32] = "n/a";
+
+  if (pc->fd[PC_CYCLES] >= 0) snprintf(cycles, sizeof(cycles), "%lld", v[PC_CYCLES]);
+  if (pc->fd[PC_INSTRUCTIONS] >= 0) snprintf(instr, sizeof(instr), "%lld", v[PC_INSTRUCTIONS]);
+  if (pc->fd[PC_CYCLES] >= 0 && pc->fd[PC_INSTRUCTIONS] >= 0 && v[PC_CYCLES] > 0) {
+    snprintf(ipc, sizeof(ipc), "%.2f", (double)v[PC_INSTRUCTIONS] / v[PC_CYCLES]);
+  }
+  if (pc->fd[PC_LLC_MISSES] >= 0 && pc->fd[PC_INSTRUCTIONS] >= 0 && v[PC_INSTRUCTIONS] > 0) {
+    snprintf(mpki, sizeof(mpki), "%.2f", 1000.0 * v[PC_LLC_MISSES] / v[PC_INSTRUCTIONS]);
+  }
+  if (pc->fd[PC_FP_SCALAR] >= 0 && pc->fd[PC_FP_128] >= 0 && pc->fd[PC_FP_256] >= 0) {
+    long long ops = v[PC_FP_SCALAR] + v[PC_FP_128] + v[PC_FP_256];
+    snprintf(flops, sizeof(flops), "%.3e",
+             (double)v[PC_FP_SCALAR] + 4.0 * v[PC_FP_128] + 8.0 * v[PC_FP_256]);
+    if (ops > 0) {
+      snprintf(simd, sizeof(simd), "%.0f%%", 100.0 * (v[PC_FP_128] + v[PC_FP_256]) / ops);
+    }
+  }
+  printf("Process %d on host %s: %-12s time %.6f s  cycles %s  instr %s  IPC %s"
+         "  LLC MPKI %s  FLOPs %s  SIMD %s\n",
+         me, host, kernel, v[PC_TASK_CLOCK] * 1e-9, cycles, instr,
+         ipc, mpki, flops, simd);
+}
+
+#endif /* PERF_COUNTERS_H */
@@ -0,0 +1,314 @@
+/* A long-running MPI program built on the distributed matrix-vector product:   */
+/* power iteration x = A*x / |A*x| for the dominant eigenvalue of A (NxN).      */
+/* Each process generates its own row block of A, so only X moves between      */
+/* processes (MPI_Allgatherv every iteration).                                  */
+
+/* Every C iterations the current X is checkpointed with MPI-IO. The write is   */
+/* started with MPI_File_iwrite_at and completed at the next checkpoint, so the */
+/* iterations in between are not blocked by the file system. Two checkpoint     */
+/* files are used in turn and a file is only marked valid after all processes  */
+/* have written their part, so there is always one consistent checkpoint. A    */
+/* checkpoint is completed when the next one starts or the run ends.            */
+/* With -r the run resumes from the newest valid checkpoint. Each process      */
+/* writes its slice of X at its global offset, so a run can also be restarted  */
+/* with a different number of processes.                                        */
+
+/* Compile the program with 'mpicc -O2 power_iteration.c -o power -lm'          */
+/* Run the program with                                                         */
+/*   'mpirun -np 4 power [-n N] [-i iterations] [-c interval] [-d dir] [-r]'    */
+/* -k K aborts after iteration K, to try out the restart.                       */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "mpi.h"
+#include "matvec_kernels.h"
+#include "row_dist.h"
+
+#define NAMELEN 80               /* Max length of machine name */
+#define PATHLEN 256              /* Max length of checkpoint file names */
+#define CKPT_MAGIC 0x43504b54L   /* Marks a complete checkpoint */
+#define CKPT_HEADER 64           /* Bytes reserved for the header */
+
+/* Header at offset 0 of a checkpoint file, X follows at CKPT_HEADER */
+typedef struct {
+  long magic;                 /* CKPT_MAGIC when complete, 0 while writing */
+  long n;                     /* Matrix size */
+  long iter;                  /* Iterations done */
+  double lambda;              /* Eigenvalue estimate at that point */
+} ckpt_header;
+
+/* State of a checkpoint that is being written */
+typedef struct {
+  int pending;                /* A write is in flight */
+  int ok;                     /* This process's part was started without error */
+  long rows;                  /* Floats this process writes */
+  MPI_File fh;
+  MPI_Request req;
+  MPI_Status status;          /* Of the write, from MPI_Test or MPI_Wait */
+  float *buf;                 /* Copy of the local X being written */
+  ckpt_header hdr;            /* Header to write once all data is written */
+} checkpoint;
+
+void ckpt_name(char *name, const char *dir, int slot) {
+  snprintf(name, PATHLEN, "%s/power_ckpt.%d", dir, slot);
+}
+
+/* Start writing the local slice of x to checkpoint slot 'slot'         */
+/* (collective). Returns 0, or -1 on all processes when the file cannot */
+/* be opened or invalidated; nothing is in flight then.                 */
+int ckpt_start(checkpoint *c, const char *dir, int slot, long n, long iter,
+               double lambda, const float *xlocal, long rows, long first, int me) {
+  char name[PATHLEN];
+  ckpt_header h = { 0, n, iter, lambda };
+  long i;
+  int ok;
+
+  ckpt_name(name, dir, slot);
+  c->fh = MPI_FILE_NULL;
+  ok = MPI_File_open(MPI_COMM_WORLD, name, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                     MPI_INFO_NULL, &c->fh) == MPI_SUCCESS;
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if (ok) {
+    /* Invalidate the slot and make that durable before any process */
+    /* overwrites its data; the reduction also acts as the barrier  */
+    if (me == 0) {
+      ok = MPI_File_write_at(c->fh, 0, &h, sizeof(h), MPI_BYTE, MPI_STATUS_IGNORE) == MPI_SUCCESS;
+    }
+    if (MPI_File_sync(c->fh) != MPI_SUCCESS) ok = 0;
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  }
+  if (!ok) {
+    if (c->fh != MPI_FILE_NULL) MPI_File_close(&c->fh);
+    return -1;
+  }
+  for (i = 0; i < rows; i++) {
+    c->buf[i] = xlocal[i];
+  }
+  c->rows = rows;
+  c->ok = MPI_File_iwrite_at(c->fh, CKPT_HEADER + first * (MPI_Offset)sizeof(float),
+                             c->buf, (int)rows, MPI_FLOAT, &c->req) == MPI_SUCCESS;
+  if (!c->ok) c->req = MPI_REQUEST_NULL;
+  h.magic = CKPT_MAGIC;
+  c->hdr = h;
+  c->pending = 1;
+  return 0;
+}
+
+/* Complete the checkpoint in flight and mark it valid if every process */
+/* wrote all of its part (collective). Returns 0, or -1 when it is left */
+/* invalid.                                                             */
+int ckpt_finish(checkpoint *c, int me) {
+  int got, ok = c->ok;
+  if (!c->pending) return 0;
+  /* The write may already have completed in MPI_Test, with its status */
+  if (c->req != MPI_REQUEST_NULL && MPI_Wait(&c->req, &c->status) != MPI_SUCCESS) ok = 0;
+  if (ok && (MPI_Get_count(&c->status, MPI_FLOAT, &got) != MPI_SUCCESS || got != c->rows)) {
+    ok = 0;
+  }
+  if (MPI_File_sync(c->fh) != MPI_SUCCESS) ok = 0;
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if (me == 0 && ok) {
+    MPI_File_write_at(c->fh, 0, &c->hdr, sizeof(c->hdr), MPI_BYTE, MPI_STATUS_IGNORE);
+  }
+  MPI_File_close(&c->fh);
+  c->pending = 0;
+  return ok ? 0 : -1;
+}
+
+/* Load the newest valid checkpoint for size n into x (full vector)      */
+/* (collective). Returns the number of iterations done, or 0 if there is */
+/* none or it cannot be read completely; *slot is set to its slot.       */
+long ckpt_restore(const char *dir, long n, float *x, double *lambda, int *slot) {
+  char name[PATHLEN];
+  ckpt_header h, best = { 0, 0, 0, 0.0 };
+  int s, best_slot = -1, ok, got;
+  MPI_Status status;
+  MPI_File fh = MPI_FILE_NULL;
+
+  for (s = 0; s < 2; s++) {
+    ckpt_name(name, dir, s);
+    fh = MPI_FILE_NULL;
+    ok = MPI_File_open(MPI_COMM_WORLD, name, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) == MPI_SUCCESS;
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (ok) {
+      ok = MPI_File_read_at_all(fh, 0, &h, sizeof(h), MPI_BYTE, &status) == MPI_SUCCESS &&
+           MPI_Get_count(&status, MPI_BYTE, &got) == MPI_SUCCESS && got == (int)sizeof(h) &&
+           h.magic == CKPT_MAGIC && h.n == n && h.iter > best.iter;
+      MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+      if (ok) {
+        best = h;
+        best_slot = s;
+      }
+    }
+    if (fh != MPI_FILE_NULL) MPI_File_close(&fh);
+  }
+  if (best_slot < 0) return 0;
+
+  ckpt_name(name, dir, best_slot);
+  ok = MPI_File_open(MPI_COMM_WORLD, name, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) == MPI_SUCCESS;
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if (ok) {
+    ok = MPI_File_read_at_all(fh, CKPT_HEADER, x, (int)n, MPI_FLOAT, &status) == MPI_SUCCESS &&
+         MPI_Get_count(&status, MPI_FLOAT, &got) == MPI_SUCCESS && got == n;
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  }
+  if (fh != MPI_FILE_NULL) MPI_File_close(&fh);
+  if (!ok) return 0;
+  *lambda = best.lambda;
+  *slot = best_slot;
+  return best.iter;
+}
+
+int main(int argc, char* argv[]) {
+  int p, opt, np, me;
+  const int root = 0;
+  char myname[NAMELEN];       /* Local host name string */
+
+  long n = 2048;              /* Matrix size */
+  long iterations = 200;      /* Total iterations */
+  long interval = 20;         /* Iterations between checkpoints */
+  long kill_at = -1;          /* Abort after this iteration */
+  const char *dir = ".";      /* Checkpoint directory, e.g. the NFS share */
+  int restart = 0;
+
+  long i, j, k, start, rows, first;
+  float *localA, *x, *y;
+  int *counts, *displs;
+  double sums[2], global[2], lambda = 0.0, t0;
+  checkpoint ckpt = { 0 };
+  int slot = 0;               /* Slot of the next checkpoint */
+
+  MPI_Init(&argc, &argv);                /* Initialize MPI */
+  MPI_Comm_size(MPI_COMM_WORLD, &np);    /* Get nr of processes */
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);    /* Get own identifier */
+
+  gethostname(myname, NAMELEN);    /* Get host name */
+
+  while ((opt = getopt(argc, argv, "n:i:c:d:k:r")) != -1) {
+    switch (opt) {
+    case 'n': n = atol(optarg); break;
+    case 'i': iterations = atol(optarg); break;
+    case 'c': interval = atol(optarg); break;
+    case 'd': dir = optarg; break;
+    case 'k': kill_at = atol(optarg); break;
+    case 'r': restart = 1; break;
+    default:
+      if (me == root) printf("Usage: power [-n N] [-i iterations] [-c interval] [-d dir] [-k K] [-r]\n");
+      MPI_Finalize();
+      exit(0);
+    }
+  }
+  if (n < np || n > 2147483647L) {
+    if (me == root) printf("N must be between the number of processes and 2^31-1\n");
+    MPI_Finalize();
+    exit(0);
+  }
+
+  rows = num_rows(n, np, me);
+  first = first_row(n, np, me);
+  localA = malloc((size_t)rows * n * sizeof(float));
+  x = malloc(n * sizeof(float));
+  y = malloc(rows * sizeof(float));
+  ckpt.buf = malloc(rows * sizeof(float));
+  counts = malloc(np * sizeof(int));
+  displs = malloc(np * sizeof(int));
+  if (localA == NULL || x == NULL || y == NULL || ckpt.buf == NULL) {
+    printf("Process %d on host %s: out of memory for N = %ld\n", me, myname, n);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  for (p = 0; p < np; p++) {
+    counts[p] = (int)num_rows(n, np, p);
+    displs[p] = (int)first_row(n, np, p);
+  }
+
+  /* Local row block of a symmetric test matrix */
+  for (i = 0; i < rows; i++) {
+    for (j = 0; j < n; j++) {
+      localA[(size_t)i * n + j] = 1.0f / (1.0f + labs(first + i - j));
+    }
+  }
+
+  start = restart ? ckpt_restore(dir, n, x, &lambda, &slot) : 0;
+  if (start > 0) {
+    /* Keep the checkpoint just restored until a newer one is valid */
+    slot = 1 - slot;
+  } else {
+    for (j = 0; j < n; j++) {
+      x[j] = 1.0f / sqrtf((float)n);
+    }
+  }
+  if (me == root) {
+    if (restart && start > 0) {
+      printf("Resuming from checkpoint at iteration %ld (lambda = %.8f)\n", start, lambda);
+    } else if (restart) {
+      printf("No valid checkpoint in %s, starting from scratch\n", dir);
+    }
+  }
+
+  t0 = MPI_Wtime();
+  for (k = start + 1; k <= iterations; k++) {
+    /* y = A x for the local rows */
+    matvec_f32(rows, n, localA, x, y);
+
+    /* |y|^2 and x.y in one reduction */
+    sums[0] = sums[1] = 0.0;
+    for (i = 0; i < rows; i++) {
+      sums[0] += (double)y[i] * y[i];
+      sums[1] += (double)x[first + i] * y[i];
+    }
+    MPI_Allreduce(sums, global, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    lambda = global[1];
+
+    /* Normalize the local slice and share it */
+    for (i = 0; i < rows; i++) {
+      y[i] = (float)(y[i] / sqrt(global[0]));
+    }
+    MPI_Allgatherv(y, (int)rows, MPI_FLOAT, x, counts, displs, MPI_FLOAT, MPI_COMM_WORLD);
+
+    /* Drive progress of the checkpoint write in flight */
+    if (ckpt.pending && ckpt.req != MPI_REQUEST_NULL) {
+      int done;
+      MPI_Test(&ckpt.req, &done, &ckpt.status);
+    }
+
+    if (interval > 0 && k % interval == 0) {
+      if (ckpt_finish(&ckpt, me) != 0 && me == root) {
+        printf("Checkpoint in %s could not be completed, it stays invalid\n", dir);
+      }
+      if (ckpt_start(&ckpt, dir, slot, n, k, lambda, &x[first], rows, first, me) != 0) {
+        if (me == root) printf("Cannot write checkpoints to %s, checkpointing disabled\n", dir);
+        interval = 0;
+      }
+      slot = 1 - slot;
+    }
+
+    if (me == root && (k % 10 == 0 || k == iterations)) {
+      printf("Iteration %5ld: lambda = %.8f\n", k, lambda);
+    }
+
+    if (k == kill_at) {
+      if (me == root) printf("Aborting after iteration %ld\n", k);
+      MPI_Abort(MPI_COMM_WORLD, 2);
+    }
+  }
+  if (ckpt_finish(&ckpt, me) != 0 && me == root) {
+    printf("Checkpoint in %s could not be completed, it stays invalid\n", dir);
+  }
+
+  if (me == root) {
+    printf("\nDominant eigenvalue of the %ldx%ld test matrix: %.8f\n", n, n, lambda);
+    printf("Iterations %ld..%ld took %.3f s on %d processes\n",
+           start + 1, iterations, MPI_Wtime() - t0, np);
+  }
+
+  free(localA);
+  free(x);
+  free(y);
+  free(ckpt.buf);
+  free(counts);
+  free(displs);
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,60 @@
+/* Asynchronous progress for nonblocking MPI operations.                 */
+
+/* Many MPI libraries only move data of a nonblocking collective while  */
+/* the application is inside an MPI call. A progress thread keeps        */
+/* calling MPI_Iprobe on a private communicator, which drives the        */
+/* progress engine while the main thread computes. It needs             */
+/* MPI_THREAD_MULTIPLE; link with -pthread.                              */
+/* The alternative without threads is to call MPI_Test on the pending   */
+/* request every few rows of the compute loop.                           */
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <pthread.h>
+#include <sched.h>
+#include "mpi.h"
+
+typedef struct {
+  pthread_t thread;
+  MPI_Comm comm;              /* Private communicator that is probed */
+  volatile int stop;          /* Set by progress_stop() */
+  int running;
+} progress_thread;
+
+static void *progress_loop(void *arg) {
+  progress_thread *pt = arg;
+  int flag;
+  while (!pt->stop) {
+    MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, pt->comm, &flag, MPI_STATUS_IGNORE);
+    sched_yield();
+  }
+  return NULL;
+}
+
+/* Start the thread. Returns 0 if MPI was not initialized with          */
+/* MPI_THREAD_MULTIPLE, in which case no thread is started.             */
+static inline int progress_start(progress_thread *pt) {
+  int provided;
+  pt->running = 0;
+  MPI_Query_thread(&provided);
+  if (provided < MPI_THREAD_MULTIPLE) return 0;
+  MPI_Comm_dup(MPI_COMM_WORLD, &pt->comm);
+  pt->stop = 0;
+  if (pthread_create(&pt->thread, NULL, progress_loop, pt) != 0) {
+    MPI_Comm_free(&pt->comm);
+    return 0;
+  }
+  pt->running = 1;
+  return 1;
+}
+
+static inline void progress_stop(progress_thread *pt) {
+  if (!pt->running) return;
+  pt->stop = 1;
+  pthread_join(pt->thread, NULL);
+  MPI_Comm_free(&pt->comm);
+  pt->running = 0;
+}
+
+#endif /* PROGRESS_H */
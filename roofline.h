@@ -0,0 +1,146 @@
+/* Roofline placement of the local kernels.                              */
+
+/* The roofline bounds a kernel with arithmetic intensity I (FLOPs per   */
+/* byte of memory traffic) by min(peak FLOP/s, I * bandwidth). The two   */
+/* peaks are measured once per node: a STREAM-like triad for bandwidth   */
+/* and a chain-free FMA loop on vector registers for compute. All ranks  */
+/* of a node run them at the same time, so the figures are what one rank */
+/* gets while its neighbours are busy too. The result is cached in      */
+/* .roofline_<host>_<ranks per node> in the working directory and later */
+/* runs read it; delete the file after changing the VM shape.           */
+/* The FLOP peak is the one this build can reach; compile with          */
+/* -march=native so that it uses the widest vectors of the CPU.          */
+
+#ifndef ROOFLINE_H
+#define ROOFLINE_H
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "mpi.h"
+
+#define ROOFLINE_STREAM_LEN (1L << 24)   /* Floats per triad array */
+#define ROOFLINE_REPEAT 5                /* Best of this many passes */
+#define ROOFLINE_FMA_ITER 20000000L      /* Iterations of the FMA loop */
+
+typedef float roofline_vec __attribute__((vector_size(32)));
+
+/* Triad bandwidth in bytes/s, best of ROOFLINE_REPEAT passes */
+static double roofline_stream(void) {
+  long i, n = ROOFLINE_STREAM_LEN;
+  int r;
+  float *a = malloc(n * sizeof(float));
+  float *b = malloc(n * sizeof(float));
+  float *c = malloc(n * sizeof(float));
+  double t, best = 1e30;
+
+  if (a == NULL || b == NULL || c == NULL) {
+    free(a); free(b); free(c);
+    return 0.0;
+  }
+  for (i = 0; i < n; i++) {
+    a[i] = 0.0f;
+    b[i] = 1.0f;
+    c[i] = 2.0f;
+  }
+  for (r = 0; r < ROOFLINE_REPEAT; r++) {
+    t = MPI_Wtime();
+    for (i = 0; i < n; i++) {
+      a[i] = b[i] + 3.0f * c[i];
+    }
+    t = MPI_Wtime() - t;
+    if (t < best) best = t;
+  }
+  if (a[n / 2] != 7.0f) best = 1e30;   /* keep the loop */
+  free(a); free(b); free(c);
+  return 3.0 * sizeof(float) * n / best;
+}
+
+/* Single precision FLOP/s of 8 independent multiply-add chains */
+static double roofline_flops(void) {
+  roofline_vec x0 = {0}, x1 = {0}, x2 = {0}, x3 = {0};
+  roofline_vec x4 = {0}, x5 = {0}, x6 = {0}, x7 = {0};
+  roofline_vec m, s, sum;
+  volatile float seed = 0.999f;
+  long i;
+  int k;
+  double t;
+  float total = 0.0f;
+
+  for (k = 0; k < 8; k++) {
+    m[k] = seed;
+    s[k] = 1e-3f;
+  }
+  t = MPI_Wtime();
+  for (i = 0; i < ROOFLINE_FMA_ITER; i++) {
+    x0 = x0 * m + s; x1 = x1 * m + s; x2 = x2 * m + s; x3 = x3 * m + s;
+    x4 = x4 * m + s; x5 = x5 * m + s; x6 = x6 * m + s; x7 = x7 * m + s;
+  }
+  t = MPI_Wtime() - t;
+  sum = x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7;
+  for (k = 0; k < 8; k++) total += sum[k];
+  if (total == 12345.0f) printf("\n");   /* keep the loop */
+  return 2.0 * 8 * 8 * ROOFLINE_FMA_ITER / t;
+}
+
+/* Peak bandwidth (bytes/s) and FLOP/s per rank on this node, measured */
+/* or read from the cache (collective over MPI_COMM_WORLD)             */
+static inline void roofline_peaks(double *bandwidth, double *flops) {
+  MPI_Comm node;
+  int nme, ppn, found = 0;
+  char host[64], name[128];
+  double peaks[2] = { 0.0, 0.0 };
+  FILE *f;
+
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+  MPI_Comm_rank(node, &nme);
+  MPI_Comm_size(node, &ppn);
+  gethostname(host, sizeof(host));
+  host[sizeof(host) - 1] = '\0';
+  snprintf(name, sizeof(name), ".roofline_%s_%d", host, ppn);
+
+  if (nme == 0 && (f = fopen(name, "r")) != NULL) {
+    found = (fscanf(f, "%lf %lf", &peaks[0], &peaks[1]) == 2);
+    fclose(f);
+  }
+  MPI_Bcast(&found, 1, MPI_INT, 0, node);
+  if (!found) {
+    MPI_Barrier(node);
+    peaks[0] = roofline_stream();
+    MPI_Barrier(node);
+    peaks[1] = roofline_flops();
+    if (nme == 0 && (f = fopen(name, "w")) != NULL) {
+      fprintf(f, "%.6e %.6e\n", peaks[0], peaks[1]);
+      fclose(f);
+    }
+  }
+  MPI_Bcast(peaks, 2, MPI_DOUBLE, 0, node);
+  MPI_Comm_free(&node);
+  *bandwidth = peaks[0];
+  *flops = peaks[1];
+}
+
+/* Print where a kernel that did 'flops' operations and moved 'bytes'    */
+/* in 'seconds' sits on the roofline. Above the roof the cached peaks    */
+/* are stale or the data stayed in cache, and the line says so.          */
+static inline void roofline_report(int me, const char *host, const char *kernel,
+                                   double flops, double bytes, double seconds,
+                                   double peak_bw, double peak_flops) {
+  double ai = flops / bytes;
+  double roof = ai * peak_bw < peak_flops ? ai * peak_bw : peak_flops;
+  double achieved = flops / seconds;
+  int memory_bound = ai * peak_bw < peak_flops;
+
+  printf("Process %d on host %s: %-12s AI %.3f FLOP/B  %.2f GFLOP/s of %.2f attainable (%.0f%%)"
+         "  %s-bound, %.0f%% of peak %s\n",
+         me, host, kernel, ai, achieved * 1e-9, roof * 1e-9, 100.0 * achieved / roof,
+         memory_bound ? "memory" : "compute",
+         memory_bound ? 100.0 * bytes / seconds / peak_bw : 100.0 * achieved / peak_flops,
+         memory_bound ? "bandwidth" : "FLOP/s");
+  if (achieved > roof) {
+    printf("Process %d on host %s: %-12s above the roof: peaks stale or kernel cache-resident; "
+           "delete .roofline_%s_* to measure the peaks again\n", me, host, kernel, host);
+  }
+}
+
+#endif /* ROOFLINE_H */
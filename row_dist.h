@@ -0,0 +1,142 @@
+/* Row-block distribution of an n x n matrix over the processes.         */
+
+/* Rows are split as evenly as possible: the first n % np processes get  */
+/* one row more than the others. Rows are transferred as a contiguous    */
+/* row datatype, so MPI counts and displacements are in rows and stay    */
+/* small even when the matrix has more than 2^31 elements.               */
+
+#ifndef ROW_DIST_H
+#define ROW_DIST_H
+
+#include <stdlib.h>
+#include "mpi.h"
+
+#define MAX_MSG_BYTES (1L << 30)     /* Largest scatter message per process */
+
+_Static_assert(sizeof(long) == 8, "64-bit long required for global indexing");
+
+/* First global row owned by process p when n rows are split over np */
+static inline long first_row(long n, int np, int p) {
+  return p * (n / np) + (p < n % np ? p : n % np);
+}
+
+/* Number of rows owned by process p */
+static inline long num_rows(long n, int np, int p) {
+  return n / np + (p < n % np ? 1 : 0);
+}
+
+/* Number of rounds of a scatter that sends at most 'chunk' rows to each */
+/* process per round; process 0 has the most rows                        */
+static inline long num_rounds(long n, int np, long chunk) {
+  return (num_rows(n, np, 0) + chunk - 1) / chunk;
+}
+
+/* Counts and displacements, in rows, for round r of such a scatter */
+static inline void round_counts(long n, int np, long chunk, long r,
+                                int *counts, int *displs) {
+  int p;
+  for (p = 0; p < np; p++) {
+    long left = num_rows(n, np, p) - r * chunk;
+    counts[p] = (int)(left < 0 ? 0 : (left < chunk ? left : chunk));
+    displs[p] = (int)(first_row(n, np, p) + r * chunk);
+  }
+}
+
+/* Scatter the row blocks of the n-row matrix A on root into localA.     */
+/* Each row is one 'rowtype' of 'rowbytes' bytes. Each round moves at    */
+/* most MAX_MSG_BYTES to any process.                                    */
+/* Root may pass MPI_IN_PLACE as localA: its rows then stay where they   */
+/* are in A (from row first_row(n, np, root)) and are not copied.        */
+static inline void scatter_rows(const void *A, void *localA, long n, long rowbytes,
+                                int np, int me, MPI_Datatype rowtype, int root) {
+  long r, rounds, chunk = MAX_MSG_BYTES / rowbytes;
+  int *counts = malloc(np * sizeof(int));
+  int *displs = malloc(np * sizeof(int));
+
+  if (chunk < 1) chunk = 1;
+  rounds = num_rounds(n, np, chunk);
+
+  for (r = 0; r < rounds; r++) {
+    round_counts(n, np, chunk, r, counts, displs);
+    MPI_Scatterv(A, counts, displs, rowtype,
+                 localA == MPI_IN_PLACE ? MPI_IN_PLACE :
+                 (char *)localA + (size_t)(r * chunk) * rowbytes, counts[me], rowtype,
+                 root, MPI_COMM_WORLD);
+  }
+  free(counts);
+  free(displs);
+}
+
+/* The reverse: gather the row blocks localA into A on root, in the same */
+/* rounds. Root may pass MPI_IN_PLACE as localA when its rows already    */
+/* are in place in A.                                                    */
+static inline void gather_rows(const void *localA, void *A, long n, long rowbytes,
+                               int np, int me, MPI_Datatype rowtype, int root) {
+  long r, rounds, chunk = MAX_MSG_BYTES / rowbytes;
+  int *counts = malloc(np * sizeof(int));
+  int *displs = malloc(np * sizeof(int));
+
+  if (chunk < 1) chunk = 1;
+  rounds = num_rounds(n, np, chunk);
+
+  for (r = 0; r < rounds; r++) {
+    round_counts(n, np, chunk, r, counts, displs);
+    MPI_Gatherv(localA == MPI_IN_PLACE ? MPI_IN_PLACE :
+                (const char *)localA + (size_t)(r * chunk) * rowbytes, counts[me], rowtype,
+                A, counts, displs, rowtype, root, MPI_COMM_WORLD);
+  }
+  free(counts);
+  free(displs);
+}
+
+/* Read the own row block of an n-row matrix stored row after row from  */
+/* 'offset' in the file fh (collective), in the rounds of scatter_rows, */
+/* so a process never holds more than its own rows. Returns 0, or -1   */
+/* when a read fails or returns fewer rows than requested (short file). */
+/* The result is local to the process.                                  */
+static inline int read_rows(MPI_File fh, MPI_Offset offset, void *localA, long n,
+                            long rowbytes, int np, int me, MPI_Datatype rowtype) {
+  long r, rounds, chunk = MAX_MSG_BYTES / rowbytes;
+  int *counts = malloc(np * sizeof(int));
+  int *displs = malloc(np * sizeof(int));
+  int ok = 1, got;
+  MPI_Status status;
+
+  if (chunk < 1) chunk = 1;
+  rounds = num_rounds(n, np, chunk);
+
+  for (r = 0; r < rounds; r++) {
+    round_counts(n, np, chunk, r, counts, displs);
+    if (MPI_File_read_at_all(fh, offset + displs[me] * (MPI_Offset)rowbytes,
+                             (char *)localA + (size_t)(r * chunk) * rowbytes, counts[me],
+                             rowtype, &status) != MPI_SUCCESS ||
+        MPI_Get_count(&status, rowtype, &got) != MPI_SUCCESS || got != counts[me]) ok = 0;
+  }
+  free(counts);
+  free(displs);
+  return ok ? 0 : -1;
+}
+
+/* The reverse: write the own row block at its place in the file */
+static inline int write_rows(MPI_File fh, MPI_Offset offset, const void *localA, long n,
+                             long rowbytes, int np, int me, MPI_Datatype rowtype) {
+  long r, rounds, chunk = MAX_MSG_BYTES / rowbytes;
+  int *counts = malloc(np * sizeof(int));
+  int *displs = malloc(np * sizeof(int));
+  int ok = 1;
+
+  if (chunk < 1) chunk = 1;
+  rounds = num_rounds(n, np, chunk);
+
+  for (r = 0; r < rounds; r++) {
+    round_counts(n, np, chunk, r, counts, displs);
+    if (MPI_File_write_at_all(fh, offset + displs[me] * (MPI_Offset)rowbytes,
+                              (const char *)localA + (size_t)(r * chunk) * rowbytes, counts[me],
+                              rowtype, MPI_STATUS_IGNORE) != MPI_SUCCESS) ok = 0;
+  }
+  free(counts);
+  free(displs);
+  return ok ? 0 : -1;
+}
+
+#endif /* ROW_DIST_H */
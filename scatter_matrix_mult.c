@@ -1,132 +1,767 @@
-/* A simple MPI program that multiplies a matrix A (16x16) with a vector X (16x1)  */
-/* The program distributes rows of matrix A among processes using MPI_Scatter     */
+/* A simple MPI program that multiplies a matrix A (NxN) with a vector X (Nx1)     */
+/* The program distributes rows of matrix A among processes using MPI_Scatterv    */
 /* Each process computes its portion of the result and sends it back to master    */
 /* Process 0 combines the results to form the final output vector                 */
 
+/* N is given as the first argument (default 16). All sizes and offsets are 64-bit */
+/* and rows are sent as a contiguous row datatype, so MPI counts stay small even  */
+/* when N*N is beyond 2^31. Scatters larger than MAX_MSG_BYTES per process are    */
+/* split into several rounds (see row_dist.h). The matrix and vectors are        */
+/* printed only for small N.                                                      */
+/* For N = 16, 32, 64 or 128 the fully unrolled kernels in matvec_kernels.h are   */
+/* used for the local product, other sizes use the generic loop.                  */
+
+/* With -p ROWS the scatter of A is pipelined: it is sent in rounds of at most    */
+/* ROWS rows per process with MPI_Iscatterv, and each process computes the rows  */
+/* of one round while the next round is in flight. Progress of the transfer is   */
+/* driven by calling MPI_Test every -g rows (default 8), or by a progress thread */
+/* with -t. The program then reports how much of the scatter time was hidden    */
+/* behind computation.                                                           */
+
+/* With -T FILE every rank records a timeline of its scatter, broadcast, compute */
+/* and gather phases, written as a Chrome trace to FILE at the end (trace.h).   */
+/* With -P every rank reads hardware counters around its local product and       */
+/* prints cycles, IPC, LLC misses and FLOPs where the VM exposes them.           */
+/* With -R every rank reports where its local product sits on the roofline of    */
+/* its node (see roofline.h).                                                    */
+/* X is broadcast with a binomial tree or as scatter + allgather, whichever the  */
+/* alpha-beta model of the cluster predicts to be faster. The model is read     */
+/* from the comm_bench profile given with -M (default comm_profile.txt), see    */
+/* comm_model.h. With -p auto the model also picks the pipeline chunk size.     */
+/* The same model decides whether A is scattered by the MPI library over all   */
+/* ranks or node by node, first to one leader per node and then within the    */
+/* nodes (blocking scatter only).                                               */
+/* With -A the program autotunes the row and column blocks and the threads per  */
+/* rank of the local product and the pipeline chunk size on the data it just    */
+/* distributed, and stores the winners in the tuning file given with -D         */
+/* (default tuning.db). Later runs with the same CPU, number of ranks and size  */
+/* class use them automatically, -p auto then takes the tuned chunk size.       */
+/* With -B b, A is banded with half bandwidth b (a(i,j) = i*N+j for |i-j| <= b, */
+/* 0 otherwise) and stored as its 2b+1 diagonals (see band_matrix.h). Process   */
+/* 0 then scatters the band rows and only the matching slices of X; each        */
+/* process gets the b entries of X it needs beyond its slice from its two      */
+/* neighbours with MPI_Neighbor_alltoallv instead of a broadcast of all of X.  */
+/* -p and -A do not apply to the banded mode.                                   */
+/* Process 0 keeps its own rows of A where they are in matA and computes on     */
+/* them there (MPI_IN_PLACE in the scatter), and writes its part of the result  */
+/* directly into the result vector, which is gathered in place. It holds no     */
+/* separate copy of its partition.                                              */
+/* With -L or -I FILE the run is root-free: process 0 holds no global matrix or */
+/* result either, so no process holds more than its own rows and the largest N  */
+/* grows with the memory of the whole cluster. With -L every process generates */
+/* its rows of A and all of X itself; with -I it reads them from FILE with      */
+/* MPI-IO, N*N floats of A row after row followed by the N floats of X. Each    */
+/* process checks its own rows and only the largest error is reduced; for a    */
+/* file there is no reference and the sum of the result is printed instead.    */
+/* The file must hold exactly N*N+N floats. -p, -A and -B do not apply to the   */
+/* root-free mode.                                                              */
+/* With -O FILE every process writes its part of the result to FILE in         */
+/* parallel with MPI-IO, as N floats. At the end the program reports the peak  */
+/* memory and the matrix and vector storage of the largest process.            */
+
+/* Compile the program with                                                      */
+/*   'mpicc -O2 -fopenmp -pthread scatter_matrix_mult.c -o mult -lm'              */
+/* Run the program with                                                          */
+/*   'mpirun -np 4 mult [-p ROWS|auto [-g ROWS] [-t]] [-T FILE] [-P] [-R]         */
+/*                      [-M PROFILE] [-A] [-D FILE] [-B b] [-L|-I FILE] [-O FILE] */
+/*                      [N]'                                                      */
+
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include <sys/resource.h>
 #include "mpi.h"
+#include "matvec_kernels.h"
+#include "row_dist.h"
+#include "progress.h"
+#include "trace.h"
+#include "perf_counters.h"
+#include "roofline.h"
+#include "comm_model.h"
+#include "tuning.h"
+#include "band_matrix.h"
+
+#define DEFAULT_N 16                 /* Default matrix size N x N */
+#define NAMELEN 80                   /* Max length of machine name */
+#define PRINT_LIMIT 16               /* Largest N that is printed in full */
+#define TRACE_EVENTS 65536           /* Events kept per rank with -T */
 
-#define N 16     /* Matrix size N x N */
-#define NAMELEN 80   /* Max length of machine name */
+/* Timings of the pipelined scatter */
+typedef struct {
+  double comm;                /* Blocking scatter of the same rounds */
+  double wait;                /* Time blocked in MPI_Wait when overlapped */
+  double compute;             /* Local product */
+  double total;               /* Overlapped scatter and product */
+} overlap_times;
+
+/* Scatter A in rounds of 'chunk' rows per process and compute the rows  */
+/* of each round while the next one is in flight. MPI_Test is called     */
+/* every 'granularity' rows unless a progress thread is running.         */
+/* X must already be on all processes. The product uses the blocking    */
+/* and threads in tp. Counters in pc, if not NULL, cover the compute    */
+/* blocks. On root, localA points to its own rows within matA, which    */
+/* are scattered in place.                                               */
+void pipelined_matvec(const float *matA, float *localA, const float *matX,
+                      float *localResult, long n, long chunk, long granularity,
+                      int use_thread, int np, int me, MPI_Datatype rowtype,
+                      int root, const tune_params *tp, perf_counters *pc,
+                      overlap_times *t) {
+  long r, rounds = num_rounds(n, np, chunk), i, len;
+  int *counts[2], *displs[2];
+  MPI_Request req;
+  double t0;
+  int flag;
+
+  counts[0] = malloc(np * sizeof(int));
+  counts[1] = malloc(np * sizeof(int));
+  displs[0] = malloc(np * sizeof(int));
+  displs[1] = malloc(np * sizeof(int));
+
+  /* Reference: the same rounds without overlap */
+  MPI_Barrier(MPI_COMM_WORLD);
+  trace_begin("blocking scatter", TRACE_NOARG);
+  t0 = MPI_Wtime();
+  for (r = 0; r < rounds; r++) {
+    round_counts(n, np, chunk, r, counts[0], displs[0]);
+    MPI_Scatterv(matA, counts[0], displs[0], rowtype,
+                 me == root ? MPI_IN_PLACE : &localA[(size_t)r * chunk * n],
+                 counts[0][me], rowtype, root, MPI_COMM_WORLD);
+  }
+  t->comm = MPI_Wtime() - t0;
+  trace_end("blocking scatter", TRACE_NOARG);
+
+  /* Overlapped: round r+1 is in flight while round r is computed */
+  MPI_Barrier(MPI_COMM_WORLD);
+  t->wait = t->compute = 0.0;
+  t->total = MPI_Wtime();
+  round_counts(n, np, chunk, 0, counts[0], displs[0]);
+  MPI_Iscatterv(matA, counts[0], displs[0], rowtype,
+                me == root ? MPI_IN_PLACE : localA, counts[0][me], rowtype,
+                root, MPI_COMM_WORLD, &req);
+  for (r = 0; r < rounds; r++) {
+    int cur = r % 2, next = 1 - cur;
+
+    t0 = MPI_Wtime();
+    trace_begin("wait", r);
+    MPI_Wait(&req, MPI_STATUS_IGNORE);
+    trace_end("wait", r);
+    t->wait += MPI_Wtime() - t0;
+
+    if (r + 1 < rounds) {
+      round_counts(n, np, chunk, r + 1, counts[next], displs[next]);
+      MPI_Iscatterv(matA, counts[next], displs[next], rowtype,
+                    me == root ? MPI_IN_PLACE : &localA[(size_t)(r + 1) * chunk * n],
+                    counts[next][me], rowtype, root, MPI_COMM_WORLD, &req);
+    }
+
+    t0 = MPI_Wtime();
+    trace_begin("compute block", r);
+    if (pc) perf_start(pc);
+    for (i = 0; i < counts[cur][me]; i += len) {
+      long row = r * chunk + i;
+      len = counts[cur][me] - i < granularity ? counts[cur][me] - i : granularity;
+      matvec_f32_blocked(len, n, &localA[(size_t)row * n], matX, &localResult[row],
+                         tp->rb, tp->cb, (int)tp->threads);
+      if (!use_thread && req != MPI_REQUEST_NULL) {
+        MPI_Test(&req, &flag, MPI_STATUS_IGNORE);
+      }
+    }
+    if (pc) perf_stop(pc);
+    trace_end("compute block", r);
+    t->compute += MPI_Wtime() - t0;
+  }
+  t->total = MPI_Wtime() - t->total;
+
+  free(counts[0]);
+  free(counts[1]);
+  free(displs[0]);
+  free(displs[1]);
+}
+
+/* Autotune on the data already distributed: first the row block, column */
+/* block and threads of the local product, timed on the slowest rank,     */
+/* then the pipeline chunk around the model's choice. The winners are     */
+/* written to the tuning file 'db'.                                       */
+void autotune(const float *matA, float *localA, const float *matX,
+              float *localResult, long n, int np, int me, MPI_Datatype rowtype,
+              int root, const comm_model *model, const char *db) {
+  const long rbs[] = { 16, 64, 256, 1024 };
+  const long cbs[] = { 0, 4096, 1024, 256 };     /* 0 = whole rows */
+  long rows = num_rows(n, np, me), base, c, chunks[5];
+  int a, b, r, threads, max_threads = 1, ppn;
+  double t0, t, tmax, best = 1e300;
+  tune_params tp, win = { 64, 0, 0, 1 };
+  overlap_times ot;
+  MPI_Comm node;
+
+#ifdef _OPENMP
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+  MPI_Comm_size(node, &ppn);
+  MPI_Comm_free(&node);
+  max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN) / ppn;
+  MPI_Query_thread(&r);
+  if (max_threads < 1 || r < MPI_THREAD_FUNNELED) max_threads = 1;
+#else
+  (void)node;
+  (void)ppn;
+#endif
+
+  if (me == root) printf("\nAutotuning the local product (rows per rank %ld)\n", rows);
+  for (threads = 1; threads <= max_threads; threads *= 2) {
+    for (a = 0; a < 4; a++) {
+      for (b = 0; b < 4; b++) {
+        if (cbs[b] >= n) continue;
+        tp.rb = rbs[a];
+        tp.cb = cbs[b];
+        tp.threads = threads;
+        t = 1e300;
+        for (r = 0; r < 3; r++) {
+          t0 = MPI_Wtime();
+          matvec_f32_blocked(rows, n, localA, matX, localResult, tp.rb, tp.cb, threads);
+          t0 = MPI_Wtime() - t0;
+          if (t0 < t) t = t0;
+        }
+        MPI_Allreduce(&t, &tmax, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+        if (me == root) {
+          printf("  rb %5ld  cb %5ld  threads %2d  %.6f s\n",
+                 tp.rb, tp.cb ? tp.cb : n, threads, tmax);
+        }
+        if (tmax < best) {
+          best = tmax;
+          win = tp;
+        }
+      }
+    }
+  }
+
+  /* Chunk sizes around the model's choice, with the winning kernel */
+  base = comm_pipeline_chunk(model, np, num_rows(n, np, 0), n * (long)sizeof(float),
+                             best / (rows > 0 ? rows : 1));
+  chunks[0] = base / 4; chunks[1] = base / 2; chunks[2] = base;
+  chunks[3] = base * 2; chunks[4] = base * 4;
+  if (me == root) printf("Autotuning the pipeline chunk\n");
+  best = 1e300;
+  for (a = 0; a < 5; a++) {
+    c = chunks[a] < 1 ? 1 : (chunks[a] > num_rows(n, np, 0) ? num_rows(n, np, 0) : chunks[a]);
+    chunks[a] = c;
+    if (a > 0 && c == chunks[a - 1]) continue;
+    pipelined_matvec(matA, localA, matX, localResult, n, c, 8, 0, np, me,
+                     rowtype, root, &win, NULL, &ot);
+    MPI_Allreduce(&ot.total, &tmax, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    if (me == root) printf("  chunk %6ld rows  %.6f s\n", c, tmax);
+    if (tmax < best) {
+      best = tmax;
+      win.chunk = c;
+    }
+  }
+
+  if (me == root) {
+    printf("Best: rb %ld, cb %ld, threads %ld, chunk %ld; saved to %s\n",
+           win.rb, win.cb ? win.cb : n, win.threads, win.chunk, db);
+    tuning_store(db, np, n, &win);
+  }
+}
+
+/* Expected entry i of A * X for a(i,j) = i*N+j and X[j] = j+1, over the */
+/* band |i-j| <= b when band >= 0                                       */
+double expected_row(long i, long n, long band) {
+  double expect = 0.0;
+  long j;
+  if (band < 0) {
+    /* Closed form sum_j (i*n+j)*(j+1) */
+    return (double)i * n * (0.5 * n * (n + 1)) + (double)(n - 1) * n * (n + 1) / 3.0;
+  }
+  for (j = (i > band ? i - band : 0); j <= i + band && j < n; j++) {
+    expect += (double)(i * n + j) * (j + 1);
+  }
+  return expect;
+}
+
+/* Rows of A and all of X for the root-free mode: generated locally, or */
+/* read from 'infile' (A row after row, then X) with collective MPI-IO. */
+/* The file must hold exactly N*N+N floats. Returns 0, or -1 on all    */
+/* processes when it cannot be opened, has another size or a read of   */
+/* any process fails.                                                  */
+int root_free_load(const char *infile, float *localA, float *matX, long n,
+                   int np, int me, MPI_Datatype rowtype) {
+  long i, j, first = first_row(n, np, me), rows = num_rows(n, np, me);
+  MPI_File fh = MPI_FILE_NULL;
+  MPI_Offset size;
+  int ok;
+
+  if (infile == NULL) {
+    for (i = 0; i < rows; i++) {
+      for (j = 0; j < n; j++) {
+        localA[i * n + j] = (float)((first + i) * n + j);
+      }
+    }
+    for (i = 0; i < n; i++) {
+      matX[i] = (float)(i + 1);
+    }
+    return 0;
+  }
+
+  ok = MPI_File_open(MPI_COMM_WORLD, infile, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) == MPI_SUCCESS;
+  if (ok) {
+    ok = MPI_File_get_size(fh, &size) == MPI_SUCCESS &&
+         size == ((MPI_Offset)n * n + n) * (MPI_Offset)sizeof(float);
+  }
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if (ok) {
+    /* Both reads are collective, so every process takes part in both */
+    MPI_Status status;
+    int count;
+    ok = read_rows(fh, 0, localA, n, n * (long)sizeof(float), np, me, rowtype) == 0;
+    if (MPI_File_read_at_all(fh, (MPI_Offset)n * n * sizeof(float), matX, (int)n,
+                             MPI_FLOAT, &status) != MPI_SUCCESS ||
+        MPI_Get_count(&status, MPI_FLOAT, &count) != MPI_SUCCESS || count != n) ok = 0;
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  }
+  if (fh != MPI_FILE_NULL) MPI_File_close(&fh);
+  return ok ? 0 : -1;
+}
+
+/* Peak resident memory and matrix and vector bytes of the largest process */
+void report_memory(int me, int root, double databytes) {
+  struct rusage ru;
+  double peak, v[2], vmax[2];
+
+  getrusage(RUSAGE_SELF, &ru);
+  peak = ru.ru_maxrss * 1024.0;          /* kB on Linux */
+  v[0] = peak;
+  v[1] = databytes;
+  MPI_Reduce(v, vmax, 2, MPI_DOUBLE, MPI_MAX, root, MPI_COMM_WORLD);
+  if (me == root) {
+    printf("Peak memory per process: %.1f MB resident, %.1f MB of matrix and vectors "
+           "(largest process)\n", vmax[0] / 1048576.0, vmax[1] / 1048576.0);
+  }
+}
 
 int main(int argc, char* argv[]) {
-  int i, j, np, me;
-  const int resulttag = 45;    /* Tag value for sending result data */
+  int np, me;
+  long i, j;
   const int root = 0;         /* Root process in scatter */
-  MPI_Status status;          /* Status object for receive */
+  MPI_Datatype rowtype;       /* One row of A */
 
   char myname[NAMELEN];       /* Local host name string */
-  char hostname[4][NAMELEN];  
-  float matA[N][N];           /* Full matrix A on root process */
-  float matX[N];              /* Vector X to be multiplied */
-  float result[N];            /* Final result vector on root */
-  
-  float localA[N/4][N];       /* Local portion of matrix A (assuming 4 processes) */
-  float localResult[N/4];     /* Local result vector */
-  
-  int rows_per_proc;          /* Number of rows per process */
-
-  MPI_Init(&argc, &argv);                /* Initialize MPI */
+  long n;                     /* Matrix size */
+  float *matA = NULL;         /* Full matrix A on root process */
+  float *matX;                /* Vector X to be multiplied */
+  float *result = NULL;       /* Final result vector on root */
+
+  float *localA;              /* Local portion of matrix A, within matA on root */
+  float *localResult;         /* Local result vector, within result on root */
+
+  long rows_per_proc;         /* Number of rows of this process */
+  long width;                 /* Floats per stored row of A */
+
+  long chunk = 0;             /* Rows per round of the pipelined scatter, 0 = off, */
+                              /* -1 = chosen by the model */
+  long granularity = 8;       /* Rows between MPI_Test calls */
+  int use_thread = 0;         /* Drive progress with a thread */
+  int opt, provided;
+  const char *tracefile = NULL;  /* Chrome trace output, NULL = off */
+  int use_perf = 0;           /* Read hardware counters around the product */
+  perf_counters pc;
+  int use_roofline = 0;       /* Report the product on the roofline */
+  double tcompute = 0.0;      /* Time of the local product */
+  progress_thread progress;
+  overlap_times ot, otmax;
+  const char *profile = "comm_profile.txt";  /* comm_bench results */
+  comm_model model;
+  int bcast_algo = BCAST_BINOMIAL;
+  int scatter_algo = SCATTER_FLAT;
+  int use_autotune = 0;       /* Search the parameters and store them */
+  const char *db = "tuning.db";  /* Tuning file */
+  tune_params tp = { 64, 0, 0, 1 };  /* Row block, column block, chunk, threads */
+  int tuned;
+  long band = -1;             /* Half bandwidth, -1 = dense */
+  band_matrix bandA;          /* Local band rows */
+  float *haloX = NULL;        /* Own slice of X with b entries on each side */
+  int root_free = 0;          /* No process holds more than its own rows */
+  const char *infile = NULL;  /* A and X for the root-free mode, NULL = generated */
+  const char *outfile = NULL; /* Result written with MPI-IO, NULL = off */
+  double databytes;           /* Matrix and vector storage of this process */
+
+  for (opt = 1; opt < argc; opt++) {
+    if (argv[opt][0] == '-' && argv[opt][1] == 't') use_thread = 1;
+  }
+  /* The local product runs on OpenMP threads while the main thread */
+  /* makes the MPI calls, which needs at least MPI_THREAD_FUNNELED   */
+  MPI_Init_thread(&argc, &argv, use_thread ? MPI_THREAD_MULTIPLE : MPI_THREAD_FUNNELED,
+                  &provided);            /* Initialize MPI */
   MPI_Comm_size(MPI_COMM_WORLD, &np);    /* Get nr of processes */
   MPI_Comm_rank(MPI_COMM_WORLD, &me);    /* Get own identifier */
-  
-
 
   gethostname(myname, NAMELEN);    /* Get host name */
-  
-  /* Calculate how many rows each process gets */
-  rows_per_proc = N / np;
-  
-  if (me == 0) {    /* Process 0 does this */
+
+  while ((opt = getopt(argc, argv, "p:g:tT:PRM:AD:B:LI:O:")) != -1) {
+    switch (opt) {
+    case 'p': chunk = strcmp(optarg, "auto") == 0 ? -1 : atol(optarg); break;
+    case 'g': granularity = atol(optarg); break;
+    case 't': break;
+    case 'T': tracefile = optarg; break;
+    case 'P': use_perf = 1; break;
+    case 'R': use_roofline = 1; break;
+    case 'M': profile = optarg; break;
+    case 'A': use_autotune = 1; break;
+    case 'D': db = optarg; break;
+    case 'B': band = atol(optarg); break;
+    case 'L': root_free = 1; break;
+    case 'I': root_free = 1; infile = optarg; break;
+    case 'O': outfile = optarg; break;
+    default:
+      if (me == root) printf("Usage: mult [-p ROWS|auto [-g ROWS] [-t]] [-T FILE] [-P] [-R] [-M PROFILE] [-A] [-D FILE] [-B b] [-L|-I FILE] [-O FILE] [N]\n");
+      MPI_Finalize();
+      exit(0);
+    }
+  }
+  if (granularity < 1) granularity = 1;
+
+  n = (optind < argc) ? atol(argv[optind]) : DEFAULT_N;
+  if (n < np || n > 2147483647L) {
+    if (me == root) printf("N must be between the number of processes and 2^31-1\n");
+    MPI_Finalize();
+    exit(0);
+  }
+
+  if (band >= 0 && (band >= n || num_rows(n, np, np - 1) < band)) {
+    if (me == root) printf("The half bandwidth must be below N and at most the rows per process\n");
+    MPI_Finalize();
+    exit(0);
+  }
+  if (root_free && band >= 0) {
+    if (me == root) printf("-B does not apply to the root-free mode\n");
+    MPI_Finalize();
+    exit(0);
+  }
+  if (band >= 0 || root_free) {
+    chunk = 0;
+    use_autotune = 0;
+  }
+
+  /* Calculate how many rows this process gets */
+  rows_per_proc = num_rows(n, np, me);
+
+  /* A row of A is N floats, or 2b+1 diagonals in the banded mode */
+  width = (band >= 0) ? 2 * band + 1 : n;
+  MPI_Type_contiguous((int)width, MPI_FLOAT, &rowtype);
+  MPI_Type_commit(&rowtype);
+
+  matX = malloc(n * sizeof(float));
+  if (me == root && !root_free) {
+    matA = malloc((size_t)n * width * sizeof(float));
+    result = malloc(n * sizeof(float));
+  }
+  if (band >= 0) {
+    localA = (band_init(&bandA, n, band, 0) == 0) ? bandA.a : NULL;
+    haloX = malloc((rows_per_proc + 2 * band) * sizeof(float));
+  } else if (me == root && !root_free) {
+    localA = (matA != NULL) ? &matA[(size_t)first_row(n, np, root) * n] : NULL;
+  } else {
+    localA = malloc((size_t)rows_per_proc * n * sizeof(float));
+  }
+  if (me == root && !root_free) {
+    localResult = (result != NULL) ? &result[first_row(n, np, root)] : NULL;
+  } else {
+    localResult = malloc(rows_per_proc * sizeof(float));
+  }
+  if (matX == NULL || localA == NULL || localResult == NULL ||
+      (band >= 0 && haloX == NULL) ||
+      (me == root && !root_free && (matA == NULL || result == NULL))) {
+    printf("Process %d on host %s: out of memory for N = %ld\n", me, myname, n);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  /* Matrix and vector storage: X, A and the result on root unless */
+  /* root-free, own rows and result elsewhere, the halo slice of X  */
+  databytes = (double)n * sizeof(float);
+  if (me == root && !root_free) databytes += ((double)n * width + n) * sizeof(float);
+  if (me != root || root_free || band >= 0) {
+    databytes += (double)rows_per_proc * width * sizeof(float);
+  }
+  if (me != root || root_free) databytes += rows_per_proc * sizeof(float);
+  if (band >= 0) databytes += (rows_per_proc + 2 * band) * sizeof(float);
+
+  if (me == root) {
     printf("Number of processors: %d\n", np);
-    
+  }
+  if (root_free) {
+    if (root_free_load(infile, localA, matX, n, np, me, rowtype) != 0) {
+      if (me == root) {
+        printf("Cannot read A and X from %s, which must hold %ld floats\n",
+               infile, n * n + n);
+      }
+      MPI_Finalize();
+      exit(0);
+    }
+    if (me == root) {
+      printf("Root-free: A %s, no process holds more than its own rows\n",
+             infile == NULL ? "generated locally" : "read with MPI-IO");
+    }
+  } else if (me == root) {    /* Process 0 does this */
+
     /* Initialize the matrix A and vector X */
-    for (i = 0; i < N; i++) {
-      for (j = 0; j < N; j++) {
-        matA[i][j] = i * N + j;  /* Simple initialization */
+    for (i = 0; i < n; i++) {
+      if (band >= 0) {
+        /* Diagonal k of row i holds a(i, i-b+k) */
+        for (j = 0; j < width; j++) {
+          long col = i - band + j;
+          matA[i * width + j] = (col >= 0 && col < n) ? (float)(i * n + col) : 0.0f;
+        }
+      } else {
+        for (j = 0; j < n; j++) {
+          matA[i * n + j] = (float)(i * n + j);  /* Simple initialization */
+        }
       }
-      matX[i] = i + 1;  /* Initialize X with simple values */
-    }
-    
-    /* Print matrix A for verification */
-    printf("Matrix A:\n");
-    for (i = 0; i < N; i++) {
-      for (j = 0; j < N; j++) {
-        printf("%6.2f ", matA[i][j]);
+      matX[i] = (float)(i + 1);  /* Initialize X with simple values */
+    }
+
+    if (n <= PRINT_LIMIT) {
+      /* Print matrix A for verification */
+      printf("Matrix A:\n");
+      for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+          if (band < 0) printf("%6.2f ", matA[i * n + j]);
+          else printf("%6.2f ", labs(i - j) <= band ? matA[i * width + j - i + band] : 0.0f);
+        }
+        printf("\n");
       }
-      printf("\n");
-    }
-    
-    /* Print vector X for verification */
-    printf("Vector X:\n");
-    for (i = 0; i < N; i++) {
-      printf("%6.2f\n", matX[i]);
-    }
-    
-    /* Scatter the matrix A among processes */
-    MPI_Scatter(&matA[0][0], rows_per_proc * N, MPI_FLOAT, 
-                &localA[0][0], rows_per_proc * N, MPI_FLOAT, 
-                root, MPI_COMM_WORLD);
-                
-    /* Broadcast vector X to all processes */
-    MPI_Bcast(&matX[0], N, MPI_FLOAT, root, MPI_COMM_WORLD);
-    
-    /* Master also computes its portion */
-    for (i = 0; i < rows_per_proc; i++) {
-      localResult[i] = 0.0;
-      for (j = 0; j < N; j++) {
-        localResult[i] += localA[i][j] * matX[j];
+
+      /* Print vector X for verification */
+      printf("Vector X:\n");
+      for (i = 0; i < n; i++) {
+        printf("%6.2f\n", matX[i]);
       }
     }
-    
-    /* Copy master's results to the final result vector */
-    for (i = 0; i < rows_per_proc; i++) {
-      result[i] = localResult[i];
-    }
-    
-    /* Receive results from other processes */
-    for (i = 1; i < np; i++) {
-      MPI_Recv(&result[i * rows_per_proc], rows_per_proc, MPI_FLOAT,
-              i, resulttag, MPI_COMM_WORLD, &status);
-    }
-    
-    /* Print the final result vector */
-    printf("\nMatrix-Vector Multiplication Result (A * X):\n");
-    for (i = 0; i < N; i++) {
-      printf("%6.2f\n", result[i]);
-    }
-    
-  } else { /* All other processes do this */
-    
-    /* Receive scattered matrix rows */
-    MPI_Scatter(&matA[0][0], rows_per_proc * N, MPI_FLOAT, 
-                &localA[0][0], rows_per_proc * N, MPI_FLOAT, 
-                root, MPI_COMM_WORLD);
-    
-    /* Receive broadcasted vector X */
-    MPI_Bcast(&matX[0], N, MPI_FLOAT, root, MPI_COMM_WORLD);
-    
+  }
+
+  if (tracefile != NULL) {
+    trace_init(TRACE_EVENTS);
+  }
+  if (use_perf) {
+    perf_open(&pc);
+  }
+
+  comm_model_load(&model, profile);
+  tuned = tuning_load(db, np, n, &tp);
+  if (provided < MPI_THREAD_FUNNELED && tp.threads > 1) {
+    if (me == root) printf("MPI_THREAD_FUNNELED not available, the local product uses one thread\n");
+    tp.threads = 1;
+  }
+  if (chunk < 0 && tuned && tp.chunk > 0) {
+    chunk = tp.chunk;
+  } else if (chunk < 0) {
+    /* One row of the product streams rowbytes from memory */
+    double peak_bw, peak_flops;
+    roofline_peaks(&peak_bw, &peak_flops);
+    chunk = comm_pipeline_chunk(&model, np, num_rows(n, np, 0), n * (long)sizeof(float),
+                                n * sizeof(float) / peak_bw);
+  }
+
+  if (band >= 0) {
+    /* Band rows and the matching slices of X only */
+    trace_begin("scatter", TRACE_NOARG);
+    scatter_rows(matA, localA, n, width * (long)sizeof(float), np, me, rowtype, root);
+    scatter_rows(matX, &haloX[band], n, sizeof(float), np, me, MPI_FLOAT, root);
+    trace_end("scatter", TRACE_NOARG);
+
+    /* b entries of X from each neighbour */
+    trace_begin("halo", TRACE_NOARG);
+    band_halo(&bandA, haloX, band);
+    trace_end("halo", TRACE_NOARG);
+
+    trace_begin("compute", TRACE_NOARG);
+    if (use_perf) perf_start(&pc);
+    tcompute = MPI_Wtime();
+    band_matvec_range(&bandA, bandA.first, bandA.first + rows_per_proc,
+                      haloX, bandA.first - band, localResult, bandA.first);
+    tcompute = MPI_Wtime() - tcompute;
+    if (use_perf) perf_stop(&pc);
+    trace_end("compute", TRACE_NOARG);
+  } else if (chunk > 0) {
+    /* Broadcast vector X first, then overlap the scatter with the product */
+    trace_begin("bcast", TRACE_NOARG);
+    bcast_algo = comm_bcast(&model, matX, (int)n, MPI_FLOAT, root, MPI_COMM_WORLD);
+    trace_end("bcast", TRACE_NOARG);
+    if (use_thread && !progress_start(&progress)) {
+      if (me == root) printf("MPI_THREAD_MULTIPLE not available, using MPI_Test\n");
+      use_thread = 0;
+    }
+    pipelined_matvec(matA, localA, matX, localResult, n, chunk, granularity,
+                     use_thread, np, me, rowtype, root, &tp, use_perf ? &pc : NULL, &ot);
+    if (use_thread) progress_stop(&progress);
+    tcompute = ot.compute;
+
+    MPI_Reduce(&ot, &otmax, 4, MPI_DOUBLE, MPI_MAX, root, MPI_COMM_WORLD);
+    if (me == root) {
+      double hidden = 1.0 - otmax.wait / otmax.comm;
+      printf("Pipelined scatter: %ld rounds of %ld rows, progress by %s\n",
+             num_rounds(n, np, chunk), chunk,
+             use_thread ? "thread" : "MPI_Test");
+      printf("  blocking scatter %.6f s, overlapped scatter + product %.6f s\n",
+             otmax.comm, otmax.total);
+      printf("  product %.6f s, waiting %.6f s, %.1f%% of the scatter hidden\n",
+             otmax.compute, otmax.wait, 100.0 * (hidden < 0.0 ? 0.0 : hidden));
+    }
+  } else {
+    if (!root_free) {
+      /* Scatter the rows of matrix A among processes */
+      trace_begin("scatter", TRACE_NOARG);
+      scatter_algo = comm_scatter_rows(&model, matA, me == root ? MPI_IN_PLACE : localA,
+                                       n, n * (long)sizeof(float), np, rowtype, root);
+      trace_end("scatter", TRACE_NOARG);
+
+      /* Broadcast vector X to all processes */
+      trace_begin("bcast", TRACE_NOARG);
+      bcast_algo = comm_bcast(&model, matX, (int)n, MPI_FLOAT, root, MPI_COMM_WORLD);
+      trace_end("bcast", TRACE_NOARG);
+    }
+
     /* Compute local portion of the result */
-    for (i = 0; i < rows_per_proc; i++) {
-      localResult[i] = 0.0;
-      for (j = 0; j < N; j++) {
-        localResult[i] += localA[i][j] * matX[j];
-      }
+    trace_begin("compute", TRACE_NOARG);
+    if (use_perf) perf_start(&pc);
+    tcompute = MPI_Wtime();
+    matvec_f32_blocked(rows_per_proc, n, localA, matX, localResult,
+                       tp.rb, tp.cb, (int)tp.threads);
+    tcompute = MPI_Wtime() - tcompute;
+    if (use_perf) perf_stop(&pc);
+    trace_end("compute", TRACE_NOARG);
+  }
+
+  if (use_perf) {
+    perf_report(&pc, me, myname, "matvec");
+    perf_close(&pc);
+  }
+  if (use_roofline) {
+    double peak_bw, peak_flops;
+    roofline_peaks(&peak_bw, &peak_flops);
+    if (me == root) {
+      printf("Node peaks: %.2f GB/s, %.2f GFLOP/s per rank\n", peak_bw * 1e-9, peak_flops * 1e-9);
     }
-    
+    roofline_report(me, myname, "matvec", 2.0 * rows_per_proc * width,
+                    sizeof(float) * ((double)rows_per_proc * width +
+                                     (band >= 0 ? rows_per_proc + 2 * band : n) + rows_per_proc),
+                    tcompute, peak_bw, peak_flops);
+  }
+
+  if ((me != root || root_free) && n <= PRINT_LIMIT) {
     /* Print local portion for debugging */
     printf("Process %d on host %s computed results:\n", me, myname);
     for (i = 0; i < rows_per_proc; i++) {
       printf("%6.2f\n", localResult[i]);
     }
-    
-    /* Send local results back to master */
-    MPI_Send(&localResult[0], rows_per_proc, MPI_FLOAT, 
-            0, resulttag, MPI_COMM_WORLD);
   }
 
+  if (outfile != NULL) {
+    /* Each process writes its part of the result at its place in the file */
+    MPI_File fh = MPI_FILE_NULL;
+    int ok;
+    trace_begin("write", TRACE_NOARG);
+    ok = MPI_File_open(MPI_COMM_WORLD, outfile, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                       MPI_INFO_NULL, &fh) == MPI_SUCCESS;
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (ok) {
+      MPI_File_set_size(fh, (MPI_Offset)n * sizeof(float));
+      ok = write_rows(fh, 0, localResult, n, sizeof(float), np, me, MPI_FLOAT) == 0;
+    }
+    if (fh != MPI_FILE_NULL) MPI_File_close(&fh);
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    trace_end("write", TRACE_NOARG);
+    if (me == root) {
+      if (ok) printf("Result written to %s with MPI-IO\n", outfile);
+      else printf("Cannot write the result to %s\n", outfile);
+    }
+  }
+
+  if (root_free) {
+    /* Each process checks its own rows; only the largest error, or the */
+    /* checksum of a result read from file, goes to root. The checksum  */
+    /* is for information only: there is no reference for a file.      */
+    double err, v[2] = { 0.0, 0.0 }, vred[2];
+    for (i = 0; i < rows_per_proc; i++) {
+      double expect = expected_row(first_row(n, np, me) + i, n, -1);
+      err = fabs(localResult[i] - expect) / (expect > 0.0 ? expect : 1.0);
+      if (err > v[0]) v[0] = err;
+      v[1] += localResult[i];
+    }
+    MPI_Reduce(&v[0], &vred[0], 1, MPI_DOUBLE, MPI_MAX, root, MPI_COMM_WORLD);
+    MPI_Reduce(&v[1], &vred[1], 1, MPI_DOUBLE, MPI_SUM, root, MPI_COMM_WORLD);
+    if (me == root && infile == NULL) {
+      printf("\nMatrix-Vector Multiplication of size %ld done, max relative error %.3e\n",
+             n, vred[0]);
+    } else if (me == root) {
+      printf("\nMatrix-Vector Multiplication of size %ld done, result checksum %.6e "
+             "(sum of the entries, not verified)\n", n, vred[1]);
+    }
+  } else {
+    /* Gather the results; root's part is already in place */
+    trace_begin("gather", TRACE_NOARG);
+    gather_rows(me == root ? MPI_IN_PLACE : localResult, result, n, sizeof(float),
+                np, me, MPI_FLOAT, root);
+    trace_end("gather", TRACE_NOARG);
+  }
+
+  if (me == root && !root_free) {
+    if (n <= PRINT_LIMIT) {
+      /* Print the final result vector */
+      printf("\nMatrix-Vector Multiplication Result (A * X):\n");
+      for (i = 0; i < n; i++) {
+        printf("%6.2f\n", result[i]);
+      }
+    } else {
+      /* Compare with the closed form */
+      double err, maxerr = 0.0;
+      for (i = 0; i < n; i++) {
+        double expect = expected_row(i, n, band);
+        err = fabs(result[i] - expect) / (expect > 0.0 ? expect : 1.0);
+        if (err > maxerr) maxerr = err;
+      }
+      printf("\nMatrix-Vector Multiplication of size %ld done, max relative error %.3e\n",
+             n, maxerr);
+      if (band >= 0) {
+        printf("Banded with half bandwidth %ld, X scattered by slices, %ld-entry halos "
+               "from the neighbours\n", band, band);
+      } else {
+        printf("X broadcast with %s (%s cluster model)\n",
+               bcast_algo == BCAST_BINOMIAL ? "binomial tree" : "scatter + allgather",
+               model.measured ? "measured" : "default");
+        if (chunk == 0) {
+          printf("A scattered %s (%d node%s of up to %d ranks)\n",
+                 scatter_algo == SCATTER_NODE ? "node by node" : "flat by the MPI library",
+                 model.nodes, model.nodes > 1 ? "s" : "", model.ppn);
+        }
+      }
+    }
+
+  }
+
+  if (tracefile != NULL) {
+    trace_write(tracefile);
+  }
+
+  if (use_autotune) {
+    autotune(matA, localA, matX, localResult, n, np, me, rowtype, root, &model, db);
+  } else if (tuned && me == root && n > PRINT_LIMIT) {
+    printf("Tuned parameters from %s: rb %ld, cb %ld, threads %ld, chunk %ld\n",
+           db, tp.rb, tp.cb ? tp.cb : n, tp.threads, tp.chunk);
+  }
+
+  report_memory(me, root, databytes);
+
+  MPI_Type_free(&rowtype);
+  free(matA);
+  free(matX);
+  free(result);
+  if (band >= 0) {
+    band_free(&bandA);
+    free(haloX);
+  } else if (me != root || root_free) {
+    free(localA);
+  }
+  if (me != root || root_free) free(localResult);
+  comm_model_free(&model);
   MPI_Finalize();
   return 0;
 }
@@ -0,0 +1,159 @@
+/* SELL-C-sigma storage of the local rows of a csr_matrix.              */
+
+/* CSR loops over each row separately, and rows of a few entries leave  */
+/* the SIMD units idle. SELL-C-sigma (sliced ELLPACK) takes the rows    */
+/* in chunks of C = SELL_C, pads every row of a chunk to the longest    */
+/* one and stores the chunk column by column: entry j of the C rows is  */
+/* contiguous, val[cs[k] + j * C + lane]. The kernel then runs over     */
+/* the lanes in the innermost loop, so each SIMD lane works on a        */
+/* different row, as in the batched kernel of matvec_kernels.h, and     */
+/* the x entries are loaded with a gather.                              */
+/* To keep the padding small the rows are sorted by length, longest     */
+/* first, within windows of sigma rows; perm maps the sorted rows back  */
+/* and the kernel writes y in the original order, so x and y stay as    */
+/* in CSR. sigma = 1 does not sort, sigma >= rows sorts all rows.       */
+/* Column indices are int, which halves the index traffic and matches  */
+/* the gather instructions; local indices are far below 2^31.           */
+
+#ifndef SELL_MATRIX_H
+#define SELL_MATRIX_H
+
+#include <stdlib.h>
+#include "csr_matrix.h"
+
+#define SELL_C 8              /* Rows per chunk, the float SIMD width of AVX */
+
+typedef struct {
+  long rows, nnz;             /* Own rows and nonzeros before padding */
+  long sigma;                 /* Sorting window */
+  long nchunks;
+  long *cs;                   /* Start of each chunk, nchunks + 1 */
+  int *cl;                    /* Padded row length of each chunk */
+  int *col;                   /* Local column indices */
+  float *val;
+  long *perm;                 /* Sorted row r is local row perm[r] */
+} sell_matrix;
+
+static inline void sell_free(sell_matrix *s) {
+  free(s->cs);
+  free(s->cl);
+  free(s->col);
+  free(s->val);
+  free(s->perm);
+  s->cs = s->perm = NULL;
+  s->cl = s->col = NULL;
+  s->val = NULL;
+}
+
+/* Stored entries over nonzeros, 1.0 without padding */
+static inline double sell_fill(const sell_matrix *s) {
+  return s->nnz > 0 ? (double)s->cs[s->nchunks] / s->nnz : 1.0;
+}
+
+typedef struct {
+  long len, row;
+} sell_key;
+
+static int sell_cmp_len(const void *a, const void *b) {
+  const sell_key *x = a, *y = b;
+  if (x->len != y->len) return (x->len < y->len) - (x->len > y->len);
+  return (x->row > y->row) - (x->row < y->row);
+}
+
+/* Convert the local rows of m, after csr_halo_setup, to SELL-C-sigma. */
+/* Returns 0, or -1 when out of memory.                                */
+static inline int sell_from_csr(const csr_matrix *m, long sigma, sell_matrix *s) {
+  long i, k, r, w, e, row, len;
+  int j, l, last;
+  sell_key *keys = malloc((m->rows > 0 ? m->rows : 1) * sizeof(sell_key));
+
+  if (sigma < 1) sigma = 1;
+  s->rows = m->rows;
+  s->nnz = m->rowptr[m->rows];
+  s->sigma = sigma;
+  s->nchunks = (m->rows + SELL_C - 1) / SELL_C;
+  s->cs = malloc((s->nchunks + 1) * sizeof(long));
+  s->cl = malloc((s->nchunks > 0 ? s->nchunks : 1) * sizeof(int));
+  s->perm = malloc((m->rows > 0 ? m->rows : 1) * sizeof(long));
+  s->col = NULL;
+  s->val = NULL;
+  if (keys == NULL || s->cs == NULL || s->cl == NULL || s->perm == NULL) {
+    free(keys);
+    sell_free(s);
+    return -1;
+  }
+
+  /* Sort by length within each window */
+  for (i = 0; i < m->rows; i++) {
+    keys[i].len = m->rowptr[i + 1] - m->rowptr[i];
+    keys[i].row = i;
+  }
+  for (w = 0; w < m->rows; w += sigma) {
+    qsort(&keys[w], (m->rows - w < sigma) ? m->rows - w : sigma, sizeof(sell_key), sell_cmp_len);
+  }
+
+  /* Chunk lengths and starts */
+  s->cs[0] = 0;
+  for (k = 0; k < s->nchunks; k++) {
+    len = 0;
+    for (l = 0; l < SELL_C && k * SELL_C + l < m->rows; l++) {
+      if (keys[k * SELL_C + l].len > len) len = keys[k * SELL_C + l].len;
+    }
+    s->cl[k] = (int)len;
+    s->cs[k + 1] = s->cs[k] + len * SELL_C;
+  }
+  s->col = malloc((s->cs[s->nchunks] > 0 ? s->cs[s->nchunks] : 1) * sizeof(int));
+  s->val = malloc((s->cs[s->nchunks] > 0 ? s->cs[s->nchunks] : 1) * sizeof(float));
+  if (s->col == NULL || s->val == NULL) {
+    free(keys);
+    sell_free(s);
+    return -1;
+  }
+
+  /* Fill column by column; padding repeats the last column of the row */
+  /* with a zero value, so the gather stays within the row's cache lines */
+  for (k = 0; k < s->nchunks; k++) {
+    for (l = 0; l < SELL_C; l++) {
+      r = k * SELL_C + l;
+      row = (r < m->rows) ? keys[r].row : -1;
+      len = (r < m->rows) ? keys[r].len : 0;
+      last = 0;
+      if (r < m->rows) s->perm[r] = row;
+      for (j = 0; j < s->cl[k]; j++) {
+        e = s->cs[k] + (long)j * SELL_C + l;
+        if (j < len) {
+          last = (int)m->col[m->rowptr[row] + j];
+          s->col[e] = last;
+          s->val[e] = m->val[m->rowptr[row] + j];
+        } else {
+          s->col[e] = last;
+          s->val[e] = 0.0f;
+        }
+      }
+    }
+  }
+  free(keys);
+  return 0;
+}
+
+/* y = A x on the own rows, x and y in the local numbering of CSR */
+static inline void sell_spmv(const sell_matrix *s, const float *x, float *y) {
+  long k, r;
+  int j, l;
+  for (k = 0; k < s->nchunks; k++) {
+    const float *v = &s->val[s->cs[k]];
+    const int *c = &s->col[s->cs[k]];
+    float acc[SELL_C] = {0};
+    for (j = 0; j < s->cl[k]; j++) {
+      for (l = 0; l < SELL_C; l++) {
+        acc[l] += v[j * SELL_C + l] * x[c[j * SELL_C + l]];
+      }
+    }
+    for (l = 0; l < SELL_C; l++) {
+      r = k * SELL_C + l;
+      if (r < s->rows) y[s->perm[r]] = acc[l];
+    }
+  }
+}
+
+#endif /* SELL_MATRIX_H */
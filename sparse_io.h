@@ -0,0 +1,438 @@
+/* Loading sparse matrices from files into a distributed csr_matrix.    */
+
+/* Two formats are read, told apart by the first bytes of the file:     */
+/*   Matrix Market - the text 'coordinate' format of .mtx files (real,   */
+/*                   integer or pattern; general, symmetric or          */
+/*                   skew-symmetric). Every process reads and parses    */
+/*                   an equal byte range of the entries with MPI-IO.    */
+/*                   A range owns the lines that start in it, so the    */
+/*                   process also reads the byte before and a little    */
+/*                   beyond. The entries are then sent to the process   */
+/*                   owning their row with one MPI_Alltoallv and sorted */
+/*                   into CSR there.                                    */
+/*   binary        - SPB_MAGIC header, then rowptr (n + 1 longs), col   */
+/*                   (nnz longs) and val (nnz floats) of the whole      */
+/*                   matrix. Each process reads its slices directly,    */
+/*                   with no parsing and no redistribution.             */
+/* sparse_save_bin writes the binary format from a distributed matrix,  */
+/* so a .mtx file is parsed once and reloaded from binary afterwards.   */
+/* Rows are split in equal blocks as in row_dist.h; all functions are   */
+/* collective and return 0, or -1 when the file cannot be read or      */
+/* written (on all processes).                                          */
+
+#ifndef SPARSE_IO_H
+#define SPARSE_IO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "mpi.h"
+#include "row_dist.h"
+#include "csr_matrix.h"
+
+#define SPB_MAGIC  0x3130425053L  /* "SPB01" */
+#define SPB_HEADER 64             /* Bytes reserved for the header */
+#define MTX_MARGIN 4096           /* Bytes read beyond a range for its last line */
+
+/* Header at offset 0 of a binary file */
+typedef struct {
+  long magic;
+  long n;                     /* Rows and columns */
+  long nnz;
+} spb_header;
+
+/* What the Matrix Market banner and size line say */
+typedef struct {
+  long rows, cols, entries;
+  int pattern;                /* No values, every entry is 1 */
+  int symmetry;               /* 0 general, 1 symmetric, -1 skew-symmetric */
+  long data, size;            /* Offset of the first entry, file size */
+} mtx_header;
+
+/* Read 'len' bytes at 'off' in pieces of at most MAX_MSG_BYTES; */
+/* a short read (past the end of the file) fails                  */
+static inline int sio_read_at(MPI_File fh, MPI_Offset off, void *buf, long len) {
+  long done = 0;
+  MPI_Status status;
+  int got;
+  while (done < len) {
+    int piece = (int)(len - done < MAX_MSG_BYTES ? len - done : MAX_MSG_BYTES);
+    if (MPI_File_read_at(fh, off + done, (char *)buf + done, piece, MPI_BYTE,
+                         &status) != MPI_SUCCESS ||
+        MPI_Get_count(&status, MPI_BYTE, &got) != MPI_SUCCESS || got != piece) return -1;
+    done += piece;
+  }
+  return 0;
+}
+
+static inline int sio_write_at(MPI_File fh, MPI_Offset off, const void *buf, long len) {
+  long done = 0;
+  while (done < len) {
+    int piece = (int)(len - done < MAX_MSG_BYTES ? len - done : MAX_MSG_BYTES);
+    if (MPI_File_write_at(fh, off + done, (const char *)buf + done, piece, MPI_BYTE,
+                          MPI_STATUS_IGNORE) != MPI_SUCCESS) return -1;
+    done += piece;
+  }
+  return 0;
+}
+
+/* Parse the banner and size line on one process. Returns 0 or -1. */
+static inline int mtx_read_header(const char *name, mtx_header *h) {
+  char line[1024], obj[64], fmt[64], field[64], sym[64];
+  int i;
+  FILE *f = fopen(name, "r");
+
+  if (f == NULL) return -1;
+  if (fgets(line, sizeof(line), f) == NULL ||
+      sscanf(line, "%%%%MatrixMarket %63s %63s %63s %63s", obj, fmt, field, sym) != 4) {
+    fclose(f);
+    return -1;
+  }
+  for (i = 0; field[i]; i++) field[i] = (char)tolower((unsigned char)field[i]);
+  for (i = 0; sym[i]; i++) sym[i] = (char)tolower((unsigned char)sym[i]);
+  if (strcmp(fmt, "coordinate") != 0 || strcmp(field, "complex") == 0 ||
+      strcmp(sym, "hermitian") == 0) {
+    fclose(f);
+    return -1;
+  }
+  h->pattern = strcmp(field, "pattern") == 0;
+  h->symmetry = strcmp(sym, "symmetric") == 0 ? 1 : (strcmp(sym, "skew-symmetric") == 0 ? -1 : 0);
+  do {
+    if (fgets(line, sizeof(line), f) == NULL) {
+      fclose(f);
+      return -1;
+    }
+  } while (line[0] == '%' || line[strspn(line, " \t\r\n")] == '\0');
+  if (sscanf(line, "%ld %ld %ld", &h->rows, &h->cols, &h->entries) != 3) {
+    fclose(f);
+    return -1;
+  }
+  h->data = ftell(f);
+  fseek(f, 0, SEEK_END);
+  h->size = ftell(f);
+  fclose(f);
+  return 0;
+}
+
+/* Parse the lines starting in [s, e) of the file; buf holds the file  */
+/* from offset s - 1 (or s when s is the first entry), NUL-terminated. */
+/* Appends (row, col) pairs, 0-based, to *ij and values to *v.         */
+/* Returns the number of pairs, or -1 on a bad line; *lines counts the */
+/* lines read, which must add up to the entries of the size line.      */
+static inline long mtx_parse(const mtx_header *h, char *buf, long len, long s, long e,
+                             int first, long **ij, float **v, long *cap, long *lines) {
+  char *p = buf, *end = buf + len, *q, *eol;
+  long cnt = 0, i, j;
+  double a;
+
+  if (!first) {
+    /* The byte before the range: a newline means a line starts at s */
+    if (*p++ != '\n') {
+      while (p < end && *p != '\n') p++;
+      p++;
+    }
+  }
+  while (p < end && (first ? s : s - 1) + (p - buf) < e) {
+    p += strspn(p, " \t");
+    if (*p == '%' || *p == '\n' || *p == '\r' || *p == '\0') {
+      while (p < end && *p != '\n') p++;
+      p++;
+      continue;
+    }
+    /* strtol and strtod skip newlines, so every field must parse and */
+    /* end before the end of this line                                */
+    eol = memchr(p, '\n', end - p);
+    if (eol == NULL) eol = end;
+    i = strtol(p, &q, 10);
+    if (q == p || q > eol) return -1;
+    p = q;
+    j = strtol(p, &q, 10);
+    if (q == p || q > eol) return -1;
+    if (h->pattern) {
+      a = 1.0;
+    } else {
+      p = q;
+      a = strtod(p, &q);
+      if (q == p || q > eol) return -1;
+    }
+    p = eol + 1;
+    if (i < 1 || i > h->rows || j < 1 || j > h->cols) return -1;
+    (*lines)++;
+    if (cnt + 2 > *cap) {
+      *cap = 2 * *cap + 16;
+      *ij = realloc(*ij, *cap * 2 * sizeof(long));
+      *v = realloc(*v, *cap * sizeof(float));
+      if (*ij == NULL || *v == NULL) return -1;
+    }
+    (*ij)[2 * cnt] = i - 1;
+    (*ij)[2 * cnt + 1] = j - 1;
+    (*v)[cnt++] = (float)a;
+    if (h->symmetry != 0 && i != j) {
+      (*ij)[2 * cnt] = j - 1;
+      (*ij)[2 * cnt + 1] = i - 1;
+      (*v)[cnt++] = (float)(h->symmetry * a);
+    }
+  }
+  return cnt;
+}
+
+/* Sort entries of the own rows into CSR, columns ascending per row */
+static inline int sio_build_csr(csr_matrix *m, long n, long first, long rows,
+                                const long *ij, const float *v, long cnt) {
+  long i, k, a, b;
+
+  if (csr_alloc(m, n, rows, first, cnt) != 0) return -1;
+  memset(m->rowptr, 0, (rows + 1) * sizeof(long));
+  for (k = 0; k < cnt; k++) m->rowptr[ij[2 * k] - first + 1]++;
+  for (i = 0; i < rows; i++) m->rowptr[i + 1] += m->rowptr[i];
+  for (k = 0; k < cnt; k++) {
+    long r = ij[2 * k] - first;
+    long e = m->rowptr[r]++;
+    m->col[e] = ij[2 * k + 1];
+    m->val[e] = v[k];
+  }
+  for (i = rows; i > 0; i--) m->rowptr[i] = m->rowptr[i - 1];
+  m->rowptr[0] = 0;
+
+  /* Rows are short: insertion sort */
+  for (i = 0; i < rows; i++) {
+    for (a = m->rowptr[i] + 1; a < m->rowptr[i + 1]; a++) {
+      long c = m->col[a];
+      float x = m->val[a];
+      for (b = a; b > m->rowptr[i] && m->col[b - 1] > c; b--) {
+        m->col[b] = m->col[b - 1];
+        m->val[b] = m->val[b - 1];
+      }
+      m->col[b] = c;
+      m->val[b] = x;
+    }
+  }
+  return 0;
+}
+
+static inline int mtx_load(const char *name, csr_matrix *m, long *starts) {
+  int np, me, p, ok = 0;
+  long s, e, len, cnt = -1, cap, k, lines = 0, total = 0;
+  long *ij = NULL, *rij = NULL;
+  float *v = NULL, *rv = NULL;
+  int *sc, *rc, *sd, *rd, *next;
+  char *buf;
+  mtx_header h;
+  MPI_File fh;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &np);
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);
+  if (me == 0) ok = mtx_read_header(name, &h) == 0 && h.rows == h.cols;
+  MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (!ok) return -1;
+  MPI_Bcast(&h, sizeof(h), MPI_BYTE, 0, MPI_COMM_WORLD);
+  for (p = 0; p <= np; p++) starts[p] = first_row(h.rows, np, p);
+
+  /* Own byte range of the entries, plus the byte before and a margin */
+  s = h.data + (h.size - h.data) * me / np;
+  e = h.data + (h.size - h.data) * (me + 1) / np;
+  len = (e + MTX_MARGIN < h.size ? e + MTX_MARGIN : h.size) - (me > 0 ? s - 1 : s);
+  buf = malloc(len + 1);
+  cap = (e - s) / 8 + 16;
+  ij = malloc(cap * 2 * sizeof(long));
+  v = malloc(cap * sizeof(float));
+  if (MPI_File_open(MPI_COMM_WORLD, name, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+    free(buf);
+    free(ij);
+    free(v);
+    return -1;
+  }
+  if (buf != NULL && ij != NULL && v != NULL &&
+      sio_read_at(fh, me > 0 ? s - 1 : s, buf, len) == 0) {
+    buf[len] = '\0';
+    cnt = mtx_parse(&h, buf, len, s, e, me == 0, &ij, &v, &cap, &lines);
+  }
+  MPI_File_close(&fh);
+  free(buf);
+  ok = cnt >= 0;
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, &lines, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+  if (!ok || lines != h.entries) {
+    free(ij);
+    free(v);
+    return -1;
+  }
+
+  /* Send every entry to the owner of its row */
+  sc = calloc(np, sizeof(int));
+  rc = malloc(np * sizeof(int));
+  sd = malloc(np * sizeof(int));
+  rd = malloc(np * sizeof(int));
+  next = malloc(np * sizeof(int));
+  for (k = 0; k < cnt; k++) sc[csr_owner(starts, np, ij[2 * k])]++;
+  MPI_Alltoall(sc, 1, MPI_INT, rc, 1, MPI_INT, MPI_COMM_WORLD);
+  for (p = 0, sd[0] = rd[0] = 0; p < np; p++) {
+    if (p > 0) {
+      sd[p] = sd[p - 1] + sc[p - 1];
+      rd[p] = rd[p - 1] + rc[p - 1];
+    }
+    total += rc[p];
+  }
+  {
+    long *sij = malloc((cnt > 0 ? cnt : 1) * 2 * sizeof(long));
+    float *sv = malloc((cnt > 0 ? cnt : 1) * sizeof(float));
+    rij = malloc((total > 0 ? total : 1) * 2 * sizeof(long));
+    rv = malloc((total > 0 ? total : 1) * sizeof(float));
+    memcpy(next, sd, np * sizeof(int));
+    for (k = 0; k < cnt; k++) {
+      int d = next[csr_owner(starts, np, ij[2 * k])]++;
+      sij[2 * d] = ij[2 * k];
+      sij[2 * d + 1] = ij[2 * k + 1];
+      sv[d] = v[k];
+    }
+    MPI_Alltoallv(sv, sc, sd, MPI_FLOAT, rv, rc, rd, MPI_FLOAT, MPI_COMM_WORLD);
+    for (p = 0; p < np; p++) {        /* Two longs per entry */
+      sc[p] *= 2; sd[p] *= 2; rc[p] *= 2; rd[p] *= 2;
+    }
+    MPI_Alltoallv(sij, sc, sd, MPI_LONG, rij, rc, rd, MPI_LONG, MPI_COMM_WORLD);
+    free(sij);
+    free(sv);
+  }
+  free(ij);
+  free(v);
+  free(sc);
+  free(rc);
+  free(sd);
+  free(rd);
+  free(next);
+
+  ok = sio_build_csr(m, h.rows, starts[me], starts[me + 1] - starts[me], rij, rv, total) == 0;
+  free(rij);
+  free(rv);
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  return ok ? 0 : -1;
+}
+
+static inline int spb_load(const char *name, csr_matrix *m, long *starts) {
+  int np, me, p, ok, got;
+  long rows, nnz;
+  MPI_Offset colbase, valbase, size;
+  MPI_Status status;
+  spb_header h = { 0, 0, 0 };
+  MPI_File fh;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &np);
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);
+  if (MPI_File_open(MPI_COMM_WORLD, name, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+    return -1;
+  }
+  /* The header must be complete and match the size of the file */
+  ok = MPI_File_read_at_all(fh, 0, &h, sizeof(h), MPI_BYTE, &status) == MPI_SUCCESS &&
+       MPI_Get_count(&status, MPI_BYTE, &got) == MPI_SUCCESS && got == (int)sizeof(h) &&
+       MPI_File_get_size(fh, &size) == MPI_SUCCESS &&
+       h.magic == SPB_MAGIC && h.n > 0 && h.nnz >= 0 &&
+       size == SPB_HEADER + (h.n + 1) * (MPI_Offset)sizeof(long) +
+               h.nnz * (MPI_Offset)(sizeof(long) + sizeof(float));
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  if (!ok) {
+    MPI_File_close(&fh);
+    return -1;
+  }
+  for (p = 0; p <= np; p++) starts[p] = first_row(h.n, np, p);
+  rows = starts[me + 1] - starts[me];
+  colbase = SPB_HEADER + (h.n + 1) * (MPI_Offset)sizeof(long);
+  valbase = colbase + h.nnz * (MPI_Offset)sizeof(long);
+
+  /* Own row pointers first, they give the slices of col and val */
+  ok = csr_alloc(m, h.n, rows, starts[me], 0) == 0 &&
+       sio_read_at(fh, SPB_HEADER + starts[me] * (MPI_Offset)sizeof(long),
+                   m->rowptr, (rows + 1) * sizeof(long)) == 0;
+  if (ok) {
+    /* Row pointers must rise from 0 to nnz */
+    long i;
+    for (i = 0; i < rows; i++) {
+      if (m->rowptr[i + 1] < m->rowptr[i]) ok = 0;
+    }
+    if (m->rowptr[0] < 0 || m->rowptr[rows] > h.nnz ||
+        (me == 0 && m->rowptr[0] != 0) || (me == np - 1 && m->rowptr[rows] != h.nnz)) ok = 0;
+  }
+  if (ok) {
+    long base = m->rowptr[0], i;
+    nnz = m->rowptr[rows] - base;
+    for (i = 0; i <= rows; i++) m->rowptr[i] -= base;
+    free(m->col);
+    free(m->val);
+    m->nnz = nnz;
+    m->col = malloc((nnz > 0 ? nnz : 1) * sizeof(long));
+    m->val = malloc((nnz > 0 ? nnz : 1) * sizeof(float));
+    ok = m->col != NULL && m->val != NULL &&
+         sio_read_at(fh, colbase + base * (MPI_Offset)sizeof(long), m->col, nnz * sizeof(long)) == 0 &&
+         sio_read_at(fh, valbase + base * (MPI_Offset)sizeof(float), m->val, nnz * sizeof(float)) == 0;
+    for (i = 0; ok && i < nnz; i++) {
+      if (m->col[i] < 0 || m->col[i] >= h.n) ok = 0;
+    }
+  }
+  MPI_File_close(&fh);
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  return ok ? 0 : -1;
+}
+
+/* Load either format into equal row blocks; starts gets np + 1 entries */
+static inline int sparse_load(const char *name, csr_matrix *m, long *starts) {
+  int me, bin = 0;
+  long magic = 0;
+  FILE *f;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);
+  if (me == 0 && (f = fopen(name, "rb")) != NULL) {
+    bin = fread(&magic, sizeof(long), 1, f) == 1 && magic == SPB_MAGIC;
+    fclose(f);
+  }
+  MPI_Bcast(&bin, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  return bin ? spb_load(name, m, starts) : mtx_load(name, m, starts);
+}
+
+/* Write the distributed matrix m, with global column indices and the */
+/* row blocks 'starts', in the binary format                          */
+static inline int sparse_save_bin(const char *name, const csr_matrix *m, const long *starts) {
+  int np, me, ok;
+  long i, nnz = m->rowptr[m->rows], before = 0, total;
+  long *rp;
+  MPI_Offset colbase, valbase;
+  spb_header h;
+  MPI_File fh;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &np);
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);
+  MPI_Exscan(&nnz, &before, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+  if (me == 0) before = 0;
+  MPI_Allreduce(&nnz, &total, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+  if (MPI_File_open(MPI_COMM_WORLD, name, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                    MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+    return -1;
+  }
+  MPI_File_set_size(fh, 0);
+  colbase = SPB_HEADER + (m->n + 1) * (MPI_Offset)sizeof(long);
+  valbase = colbase + total * (MPI_Offset)sizeof(long);
+
+  /* Global row pointers; the last process also writes rowptr[n] */
+  rp = malloc((m->rows + 1) * sizeof(long));
+  ok = rp != NULL;
+  if (ok) {
+    for (i = 0; i <= m->rows; i++) rp[i] = m->rowptr[i] + before;
+    ok = sio_write_at(fh, SPB_HEADER + starts[me] * (MPI_Offset)sizeof(long), rp,
+                      (m->rows + (me == np - 1 ? 1 : 0)) * sizeof(long)) == 0 &&
+         sio_write_at(fh, colbase + before * (MPI_Offset)sizeof(long), m->col,
+                      nnz * sizeof(long)) == 0 &&
+         sio_write_at(fh, valbase + before * (MPI_Offset)sizeof(float), m->val,
+                      nnz * sizeof(float)) == 0;
+  }
+  free(rp);
+  if (me == 0 && ok) {
+    h.magic = SPB_MAGIC;
+    h.n = m->n;
+    h.nnz = total;
+    ok = sio_write_at(fh, 0, &h, sizeof(h)) == 0;
+  }
+  MPI_File_close(&fh);
+  MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+  return ok ? 0 : -1;
+}
+
+#endif /* SPARSE_IO_H */
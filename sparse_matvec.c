@@ -0,0 +1,393 @@
+/* An MPI program for the sparse matrix-vector product y = A x with A in CSR     */
+/* format, distributed by row blocks. Only the halo, the entries of x a       */
+/* process needs from the others, is exchanged, with one                       */
+/* MPI_Neighbor_alltoallv over the processes it actually shares columns with  */
+/* (see csr_matrix.h). The size of the halo depends on which rows end up on   */
+/* which process, so the program runs the product twice:                       */
+/*   natural     - rows in the order of the matrix, equal blocks              */
+/*   partitioned - rows reordered by process 0 with the method of -m (see     */
+/*                 partition.h) before they are scattered                      */
+/* and process 0 prints the halo statistics and the time per product of each. */
+/* Each run times the local product in CSR and in SELL-C-sigma (see          */
+/* sell_matrix.h, sorting window -S) on the same distributed matrix.          */
+/* The test matrix is the 5-point Laplacian of a GxG grid with its points     */
+/* numbered at random, the worst case for the natural order. -x adds random  */
+/* long-range couplings, which vary the row lengths as in most real matrices. */
+/* -f loads a matrix from a Matrix Market or binary file instead, parsed in   */
+/* parallel (see sparse_io.h); -w then also writes it in the binary format,  */
+/* which loads much faster next time.                                         */
+
+/* Compile the program with 'mpicc -O3 -march=native sparse_matvec.c -o spmv -lm' */
+/* (add '-DHAVE_METIS ... -lmetis' for -m metis)                               */
+/* Run the program with                                                        */
+/*   'mpirun -np 4 spmv [-g G] [-m none|rcm|bisect|metis] [-r repeat]          */
+/*                      [-s seed] [-S sigma] [-x extra] [-f file [-w binary]]' */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "mpi.h"
+#include "row_dist.h"
+#include "csr_matrix.h"
+#include "partition.h"
+#include "sell_matrix.h"
+#include "sparse_io.h"
+
+#define NAMELEN 80       /* Max length of machine name */
+#define SPMV_TOL 1e-5    /* Largest relative difference of SELL and CSR */
+
+const char *method_names[] = { "none", "rcm", "bisect", "metis" };
+
+/* Entries of x, by row in the order of the generated matrix */
+static float x_value(long g) {
+  return 1.0f + (float)(g % 7);
+}
+
+static unsigned int lcg(unsigned int *seed) {
+  *seed = *seed * 1103515245u + 12345u;
+  return *seed >> 8;
+}
+
+/* 5-point Laplacian of a GxG grid, point (r, c) numbered label[r*G+c], */
+/* plus 'extra' couplings of -0.1 between random pairs of points, which */
+/* give the rows different lengths                                      */
+static int laplace_2d(long g, long extra, unsigned int seed, csr_matrix *A) {
+  long n = g * g, i, k, e, r, c;
+  long *label = malloc(n * sizeof(long)), *point = malloc(n * sizeof(long));
+  long *pairs = malloc((2 * extra + 1) * sizeof(long)), *fill = calloc(n + 1, sizeof(long));
+
+  if (label == NULL || point == NULL || pairs == NULL || fill == NULL) return -1;
+  /* Random numbering, Fisher-Yates */
+  for (i = 0; i < n; i++) label[i] = i;
+  for (i = n - 1; i > 0; i--) {
+    long t;
+    k = (long)(lcg(&seed) % (unsigned long)(i + 1));
+    t = label[i];
+    label[i] = label[k];
+    label[k] = t;
+  }
+  for (i = 0; i < n; i++) point[label[i]] = i;
+  for (k = 0; k < extra; k++) {
+    do {
+      pairs[2 * k] = (long)(lcg(&seed) % (unsigned long)n);
+      pairs[2 * k + 1] = (long)(lcg(&seed) % (unsigned long)n);
+    } while (pairs[2 * k] == pairs[2 * k + 1]);
+    fill[pairs[2 * k]]++;
+    fill[pairs[2 * k + 1]]++;
+  }
+  if (csr_alloc(A, n, n, 0, 5 * n + 2 * extra) != 0) return -1;
+
+  for (i = 0, e = 0; i < n; i++) {
+    r = point[i] / g;
+    c = point[i] % g;
+    A->rowptr[i] = e;
+    if (r > 0)     { A->col[e] = label[point[i] - g]; A->val[e++] = -1.0f; }
+    if (c > 0)     { A->col[e] = label[point[i] - 1]; A->val[e++] = -1.0f; }
+    A->col[e] = i; A->val[e++] = 4.0f;
+    if (c < g - 1) { A->col[e] = label[point[i] + 1]; A->val[e++] = -1.0f; }
+    if (r < g - 1) { A->col[e] = label[point[i] + g]; A->val[e++] = -1.0f; }
+    k = fill[i];
+    fill[i] = e;              /* Where the extra entries of row i go */
+    e += k;
+  }
+  A->rowptr[n] = e;
+  A->nnz = e;
+  for (k = 0; k < extra; k++) {
+    long a = pairs[2 * k], b = pairs[2 * k + 1];
+    A->col[fill[a]] = b;
+    A->val[fill[a]++] = -0.1f;
+    A->col[fill[b]] = a;
+    A->val[fill[b]++] = -0.1f;
+  }
+  free(label);
+  free(point);
+  free(pairs);
+  free(fill);
+  return 0;
+}
+
+/* Exchange and multiply 'repeat' times in CSR and in SELL-C-sigma with */
+/* the row blocks m of 'starts', which are freed afterwards; y_all gets  */
+/* the CSR result on root. xg[k] is the x entry of local row k. Returns  */
+/* the CSR time per product.                                             */
+static double run_spmv(const char *label, csr_matrix *mp, const long *starts,
+                       const float *xg, int repeat, long sigma, float *y_all, int root) {
+  int np, me, p, r;
+  long i;
+  double t0, t[3];
+  csr_matrix m = *mp;
+  csr_halo h;
+  sell_matrix s;
+  float *x, *y, *ys;
+  int *counts = NULL, *displs = NULL;
+
+  MPI_Comm_size(MPI_COMM_WORLD, &np);
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);
+  csr_halo_setup(&m, starts, &h);
+  csr_halo_report(label, &m, &h, root);
+
+  x = malloc((m.rows + h.nhalo + 1) * sizeof(float));
+  y = malloc((m.rows + 1) * sizeof(float));
+  ys = malloc((m.rows + 1) * sizeof(float));
+  if (x == NULL || y == NULL || ys == NULL || sell_from_csr(&m, sigma, &s) != 0) {
+    printf("Process %d: out of memory for the vectors\n", me);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  memcpy(x, xg, m.rows * sizeof(float));
+
+  /* One untimed product in each format first, so neither timing pays */
+  /* for first-touch page faults and cold caches                       */
+  csr_halo_exchange(&m, &h, x);
+  csr_spmv_local(&m, x, y);
+  sell_spmv(&s, x, ys);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  t0 = MPI_Wtime();
+  for (r = 0; r < repeat; r++) {
+    csr_halo_exchange(&m, &h, x);
+    csr_spmv_local(&m, x, y);
+  }
+  t[0] = (MPI_Wtime() - t0) / repeat;
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  t0 = MPI_Wtime();
+  for (r = 0; r < repeat; r++) {
+    csr_halo_exchange(&m, &h, x);
+    sell_spmv(&s, x, ys);
+  }
+  t[1] = (MPI_Wtime() - t0) / repeat;
+
+  /* Both kernels add each row in the same order, but the compiler may */
+  /* contract to FMA in one and not the other (-march=native), and the  */
+  /* rows then round differently. The difference, relative to |y|, is   */
+  /* checked against SPMV_TOL, far above that rounding and far below    */
+  /* the effect of a wrong index.                                       */
+  t[2] = 0.0;
+  for (i = 0; i < m.rows; i++) {
+    double d = fabs(ys[i] - y[i]) / (fabs(y[i]) > 1.0 ? fabs(y[i]) : 1.0);
+    if (d > t[2]) t[2] = d;
+  }
+  MPI_Reduce(me == root ? MPI_IN_PLACE : t, t, 3, MPI_DOUBLE, MPI_MAX, root, MPI_COMM_WORLD);
+  if (me == root) {
+    printf("%-10s CSR %.6f s, SELL-%d-%ld %.6f s per product (fill %.3f on process 0), "
+           "relative difference %.2e (%s)\n", label, t[0], SELL_C, sigma, t[1], sell_fill(&s),
+           t[2], t[2] <= SPMV_TOL ? "ok" : "above tolerance");
+  }
+
+  if (me == root) {
+    counts = malloc(np * sizeof(int));
+    displs = malloc(np * sizeof(int));
+    for (p = 0; p < np; p++) {
+      counts[p] = (int)(starts[p + 1] - starts[p]);
+      displs[p] = (int)starts[p];
+    }
+  }
+  MPI_Gatherv(y, (int)m.rows, MPI_FLOAT, y_all, counts, displs, MPI_FLOAT,
+              root, MPI_COMM_WORLD);
+
+  csr_halo_free(&h);
+  csr_free(&m);
+  sell_free(&s);
+  free(x);
+  free(y);
+  free(ys);
+  free(counts);
+  free(displs);
+  return t[0];
+}
+
+int main(int argc, char* argv[]) {
+  int p, opt, np, me;
+  const int root = 0;
+  char myname[NAMELEN];       /* Local host name string */
+
+  long grid = 200;            /* Grid points per side */
+  int method = PART_RCM;      /* Reordering of the partitioned run */
+  int repeat = 100;           /* Timed products */
+  unsigned int seed = 1;      /* Numbering of the grid points */
+  long sigma = 64;            /* SELL-C-sigma sorting window */
+  long extra = 0;             /* Random couplings added to the Laplacian */
+  char *file = NULL;          /* Matrix file to load instead */
+  char *out = NULL;           /* Binary file to convert it to */
+
+  long i, n, rows;
+  long *starts, *perm = NULL, *myperm;
+  int *counts = NULL, *displs = NULL;
+  float *x, *y_nat = NULL, *y_part = NULL;
+  double t_nat, t_part, t_order = 0.0, t_load, diff = 0.0;
+  csr_matrix A, P, M;
+
+  MPI_Init(&argc, &argv);                /* Initialize MPI */
+  MPI_Comm_size(MPI_COMM_WORLD, &np);    /* Get nr of processes */
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);    /* Get own identifier */
+
+  gethostname(myname, NAMELEN);    /* Get host name */
+
+  while ((opt = getopt(argc, argv, "g:m:r:s:S:x:f:w:")) != -1) {
+    switch (opt) {
+    case 'g': grid = atol(optarg); break;
+    case 'm':
+      method = -1;
+      for (p = PART_NONE; p <= PART_METIS; p++) {
+        if (strcmp(optarg, method_names[p]) == 0) method = p;
+      }
+      break;
+    case 'r': repeat = atoi(optarg); break;
+    case 's': seed = (unsigned int)atol(optarg); break;
+    case 'S': sigma = atol(optarg); break;
+    case 'x': extra = atol(optarg); break;
+    case 'f': file = optarg; break;
+    case 'w': out = optarg; break;
+    default:
+      method = -1;
+    }
+  }
+  if (method < 0 || repeat < 1) {
+    if (me == root) printf("Usage: spmv [-g G] [-m none|rcm|bisect|metis] [-r repeat] [-s seed] [-S sigma] [-x extra]\n            [-f file [-w binary]]\n");
+    MPI_Finalize();
+    exit(0);
+  }
+  starts = malloc((np + 1) * sizeof(long));
+  if (starts == NULL) {
+    printf("Process %d on host %s: out of memory\n", me, myname);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  /* The natural order: either the file in equal row blocks, read in */
+  /* parallel and gathered on root for the partitioner, or the test  */
+  /* matrix built on root and scattered in equal row blocks          */
+  if (file != NULL) {
+    MPI_Barrier(MPI_COMM_WORLD);
+    t_load = MPI_Wtime();
+    if (sparse_load(file, &M, starts) != 0) {
+      if (me == root) printf("Cannot read %s as a square Matrix Market or binary matrix\n", file);
+      MPI_Finalize();
+      exit(0);
+    }
+    t_load = MPI_Wtime() - t_load;
+    n = M.n;
+    MPI_Allreduce(&M.nnz, &i, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (me == root) {
+      printf("Matrix %s, %ld rows, %ld nonzeros, loaded in %.3f s, %d processes, "
+             "partitioned with %s\n", file, n, i, t_load, np, method_names[method]);
+    }
+    if (n < np || i > 2147483647L) {
+      if (me == root) printf("Need N >= processes and fewer than 2^31 nonzeros\n");
+      MPI_Finalize();
+      exit(0);
+    }
+    if (out != NULL) {
+      t_load = MPI_Wtime();
+      if (sparse_save_bin(out, &M, starts) != 0) {
+        if (me == root) printf("Cannot write %s\n", out);
+      } else if (me == root) {
+        printf("Wrote %s in %.3f s\n", out, MPI_Wtime() - t_load);
+      }
+    }
+    if (csr_gather(&M, starts, &A, root) != 0) {
+      if (me == root) printf("Process 0 on host %s: out of memory for the gathered matrix\n", myname);
+      MPI_Finalize();
+      exit(0);
+    }
+  } else {
+    n = grid * grid;
+    if (grid < 2 || n < np || extra < 0 || 5 * n + 2 * extra > 2147483647L) {
+      if (me == root) printf("Need G >= 2, G*G >= processes and 5*G*G + 2*extra < 2^31\n");
+      MPI_Finalize();
+      exit(0);
+    }
+    if (me == root) {
+      if (laplace_2d(grid, extra, seed, &A) != 0) {
+        printf("Process %d on host %s: out of memory for G = %ld\n", me, myname, grid);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+      printf("5-point Laplacian of a %ldx%ld grid, %ld nonzeros, %d processes, "
+             "partitioned with %s\n", grid, grid, A.nnz, np, method_names[method]);
+    }
+    for (p = 0; p <= np; p++) starts[p] = first_row(n, np, p);
+    if (csr_scatter(me == root ? &A : NULL, starts, &M, root) != 0) {
+      printf("Process %d on host %s: out of memory for G = %ld\n", me, myname, grid);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+  }
+
+  if (me == root) {
+    y_nat = malloc(n * sizeof(float));
+    y_part = malloc(n * sizeof(float));
+    perm = malloc(n * sizeof(long));
+  }
+  x = malloc(n * sizeof(float));            /* Own entries of either run */
+  if (x == NULL || (me == root && (y_nat == NULL || y_part == NULL || perm == NULL))) {
+    printf("Process %d on host %s: out of memory for N = %ld\n", me, myname, n);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  rows = starts[me + 1] - starts[me];
+  for (i = 0; i < rows; i++) x[i] = x_value(starts[me] + i);
+  t_nat = run_spmv("natural", &M, starts, x, repeat, sigma, y_nat, root);
+
+  /* Reordered: permutation and blocks on root, then P = A renumbered */
+  if (me == root) {
+    t_order = MPI_Wtime();
+    switch (method) {
+    case PART_RCM:    part_rcm(&A, np, perm, starts); break;
+    case PART_BISECT: part_bisect(&A, np, perm, starts); break;
+    case PART_METIS:
+      if (part_metis(&A, np, perm, starts) == 0) break;
+      printf("Not built with METIS (-DHAVE_METIS), using bisect\n");
+      part_bisect(&A, np, perm, starts);
+      break;
+    default:
+      for (i = 0; i < n; i++) perm[i] = i;
+      part_split(&A, perm, np, starts);
+    }
+    if (csr_permute(&A, perm, &P) != 0) {
+      printf("Process %d on host %s: out of memory for N = %ld\n", me, myname, n);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    t_order = MPI_Wtime() - t_order;
+    counts = malloc(np * sizeof(int));
+    displs = malloc(np * sizeof(int));
+    for (p = 0; p < np; p++) {
+      counts[p] = (int)(starts[p + 1] - starts[p]);
+      displs[p] = (int)starts[p];
+    }
+  }
+  MPI_Bcast(starts, np + 1, MPI_LONG, root, MPI_COMM_WORLD);
+
+  /* Each process needs the original row numbers of its rows for x */
+  rows = starts[me + 1] - starts[me];
+  myperm = malloc((rows > 0 ? rows : 1) * sizeof(long));
+  MPI_Scatterv(perm, counts, displs, MPI_LONG, myperm, (int)rows, MPI_LONG,
+               root, MPI_COMM_WORLD);
+  for (i = 0; i < rows; i++) x[i] = x_value(myperm[i]);
+  if (csr_scatter(me == root ? &P : NULL, starts, &M, root) != 0) {
+    printf("Process %d on host %s: out of memory for N = %ld\n", me, myname, n);
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  t_part = run_spmv("partitioned", &M, starts, x, repeat, sigma, y_part, root);
+
+  if (me == root) {
+    /* Row k of the reordered product is row perm[k] of the natural one */
+    for (i = 0; i < n; i++) {
+      double d = fabs(y_part[i] - y_nat[perm[i]]);
+      if (d > diff) diff = d;
+    }
+    printf("Reordering took %.3f s on process 0\n", t_order);
+    printf("Largest difference %.2e, CSR speedup %.2f\n", diff, t_nat / t_part);
+    csr_free(&A);
+    csr_free(&P);
+  }
+
+  free(starts);
+  free(perm);
+  free(myperm);
+  free(counts);
+  free(displs);
+  free(x);
+  free(y_nat);
+  free(y_part);
+  MPI_Finalize();
+  return 0;
+}
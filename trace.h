@@ -0,0 +1,195 @@
+/* Timeline tracing of rank activity in Chrome trace format.             */
+
+/* trace_begin() / trace_end() store a name, an optional integer         */
+/* argument and an MPI_Wtime() stamp in a per-rank ring buffer; when the */
+/* buffer is full the oldest events are overwritten. Nothing is sent     */
+/* until trace_write(), which converts the events to JSON, collects them */
+/* on rank 0 and writes a file that can be opened in chrome://tracing or */
+/* https://ui.perfetto.dev. Each rank is shown as its own process.       */
+
+/* The clocks of the VMs are not synchronized, so trace_init() and       */
+/* trace_write() both measure the offset of every rank's clock to rank 0 */
+/* with a ping-pong, keeping the sample with the shortest round trip.    */
+/* Timestamps are corrected with an offset interpolated between the two  */
+/* measurements, which also removes linear clock drift.                  */
+
+/* Names must be string literals or otherwise outlive the trace. When    */
+/* tracing is not initialized the calls only test a flag.                */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "mpi.h"
+
+#define TRACE_SYNC_ROUNDS 20     /* Ping-pongs per clock offset measurement */
+#define TRACE_LINELEN 160        /* Max length of one JSON event */
+#define TRACE_NOARG (-1L)        /* No argument for the event */
+
+typedef struct {
+  const char *name;
+  long arg;                   /* Shown as args.k, TRACE_NOARG for none */
+  double t;                   /* Local MPI_Wtime() */
+  char ph;                    /* 'B' begin or 'E' end */
+} trace_event;
+
+static struct {
+  int enabled;
+  trace_event *ev;
+  long capacity, next, count;
+  double t_init, off_init;    /* Clock offset to rank 0 at trace_init() */
+} trace_state;
+
+/* Offset to add to the local MPI_Wtime() to get rank 0's clock (collective) */
+static double trace_clock_offset(void) {
+  int me, np, p, r;
+  const int tag = 77;
+  double t1, t2, tr, best_rtt = 1e30, offset = 0.0;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);
+  MPI_Comm_size(MPI_COMM_WORLD, &np);
+  for (p = 1; p < np; p++) {
+    for (r = 0; r < TRACE_SYNC_ROUNDS; r++) {
+      if (me == 0) {
+        MPI_Recv(&t1, 1, MPI_DOUBLE, p, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        tr = MPI_Wtime();
+        MPI_Send(&tr, 1, MPI_DOUBLE, p, tag, MPI_COMM_WORLD);
+      } else if (me == p) {
+        t1 = MPI_Wtime();
+        MPI_Send(&t1, 1, MPI_DOUBLE, 0, tag, MPI_COMM_WORLD);
+        MPI_Recv(&tr, 1, MPI_DOUBLE, 0, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        t2 = MPI_Wtime();
+        if (t2 - t1 < best_rtt) {
+          best_rtt = t2 - t1;
+          offset = tr - 0.5 * (t1 + t2);
+        }
+      }
+    }
+  }
+  return offset;
+}
+
+/* Start tracing with room for 'capacity' events per rank (collective) */
+static inline void trace_init(long capacity) {
+  trace_state.ev = malloc(capacity * sizeof(trace_event));
+  trace_state.capacity = capacity;
+  trace_state.next = trace_state.count = 0;
+  trace_state.off_init = trace_clock_offset();
+  trace_state.t_init = MPI_Wtime();
+  trace_state.enabled = (trace_state.ev != NULL);
+}
+
+static inline void trace_event_add(const char *name, long arg, char ph) {
+  trace_event *e;
+  if (!trace_state.enabled) return;
+  e = &trace_state.ev[trace_state.next];
+  e->name = name;
+  e->arg = arg;
+  e->ph = ph;
+  e->t = MPI_Wtime();
+  trace_state.next = (trace_state.next + 1) % trace_state.capacity;
+  if (trace_state.count < trace_state.capacity) trace_state.count++;
+}
+
+static inline void trace_begin(const char *name, long arg) { trace_event_add(name, arg, 'B'); }
+static inline void trace_end(const char *name, long arg)   { trace_event_add(name, arg, 'E'); }
+
+/* Length of a line that snprintf wanted to write at text + pos with     */
+/* size TRACE_LINELEN; a truncated line is cut to TRACE_LINELEN - 1      */
+/* bytes ending in a newline, so each line stays within its share of     */
+/* the buffer                                                            */
+static inline int trace_line_length(char *text, int pos, int w) {
+  if (w < 0) return 0;
+  if (w > TRACE_LINELEN - 1) {
+    w = TRACE_LINELEN - 1;
+    text[pos + w - 1] = '\n';
+  }
+  return w;
+}
+
+/* Collect the events of all ranks and write them to 'filename' on rank  */
+/* 0 (collective). Tracing stops.                                        */
+static inline void trace_write(const char *filename) {
+  int me, np, p, len = 0, total = 0;
+  int *lens = NULL, *displs = NULL;
+  long i, k, first;
+  double off_end, t_end, drift;
+  char host[64], *text, *all = NULL;
+
+  if (trace_state.ev == NULL) return;
+  trace_state.enabled = 0;
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);
+  MPI_Comm_size(MPI_COMM_WORLD, &np);
+  off_end = trace_clock_offset();
+  t_end = MPI_Wtime();
+  drift = (t_end > trace_state.t_init) ?
+          (off_end - trace_state.off_init) / (t_end - trace_state.t_init) : 0.0;
+
+  text = malloc((trace_state.count + 1) * TRACE_LINELEN);
+  if (text == NULL) {
+    printf("Rank %d: out of memory for the trace text, its events are left out\n", me);
+  } else {
+    gethostname(host, sizeof(host));
+    host[sizeof(host) - 1] = '\0';
+    len += trace_line_length(text, len,
+        snprintf(text + len, TRACE_LINELEN,
+                 "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rank %d (%.40s)\"}},\n",
+                 me, me, host));
+    first = (trace_state.next - trace_state.count + trace_state.capacity) % trace_state.capacity;
+    for (k = 0; k < trace_state.count; k++) {
+      trace_event *e = &trace_state.ev[(first + k) % trace_state.capacity];
+      double t = e->t + trace_state.off_init + drift * (e->t - trace_state.t_init);
+      if (e->arg == TRACE_NOARG) {
+        len += trace_line_length(text, len,
+            snprintf(text + len, TRACE_LINELEN,
+                     "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":0},\n",
+                     e->name, e->ph, t * 1e6, me));
+      } else {
+        len += trace_line_length(text, len,
+            snprintf(text + len, TRACE_LINELEN,
+                     "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":0,\"args\":{\"k\":%ld}},\n",
+                     e->name, e->ph, t * 1e6, me, e->arg));
+      }
+    }
+  }
+
+  if (me == 0) {
+    lens = malloc(np * sizeof(int));
+    displs = malloc(np * sizeof(int));
+  }
+  MPI_Gather(&len, 1, MPI_INT, lens, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (me == 0) {
+    for (p = 0; p < np; p++) {
+      displs[p] = total;
+      total += lens[p];
+    }
+    all = malloc(total + 1);
+  }
+  MPI_Gatherv(text, len, MPI_CHAR, all, lens, displs, MPI_CHAR, 0, MPI_COMM_WORLD);
+
+  if (me == 0) {
+    FILE *f = fopen(filename, "w");
+    if (f == NULL) {
+      printf("Cannot write trace file %s\n", filename);
+    } else {
+      /* Drop the comma after the last event */
+      for (i = total - 1; i >= 0 && all[i] != ','; i--) ;
+      if (i >= 0) all[i] = ' ';
+      fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+      fwrite(all, 1, total, f);
+      fprintf(f, "]}\n");
+      fclose(f);
+      printf("Trace of %d ranks written to %s\n", np, filename);
+    }
+    free(lens);
+    free(displs);
+    free(all);
+  }
+  free(text);
+  free(trace_state.ev);
+  trace_state.ev = NULL;
+}
+
+#endif /* TRACE_H */
@@ -0,0 +1,115 @@
+/* Persistent tuning database for the local kernel and the pipeline.     */
+
+/* The best row block, column block, pipeline chunk and threads per rank */
+/* depend on the VM shape, so an autotuning run (scatter_matrix_mult -A) */
+/* stores its winners in a text file, one line per configuration:        */
+/*   <cpu model> <cpus per VM> <ranks> <size class> rb cb chunk threads  */
+/* The size class is floor(log2 N). Later runs look up the line for the  */
+/* current configuration and use it; a newer line for the same key       */
+/* replaces the older one. Only rank 0 touches the file, the cluster is  */
+/* assumed to be homogeneous.                                            */
+
+#ifndef TUNING_H
+#define TUNING_H
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpi.h"
+
+#define TUNING_KEYLEN 128
+#define TUNING_LINELEN 512
+#define TUNING_MAXLINES 1024
+
+typedef struct {
+  long rb;                    /* Rows per block of the local product */
+  long cb;                    /* Columns per block, >= N for no blocking */
+  long chunk;                 /* Rows per round of the pipelined scatter */
+  long threads;               /* Threads per rank */
+} tune_params;
+
+/* Key of this configuration: CPU model with blanks replaced, CPUs,     */
+/* number of ranks and size class                                       */
+static inline void tuning_key(char *key, int np, long n) {
+  char line[TUNING_LINELEN], model[TUNING_KEYLEN] = "unknown";
+  char *p, *v;
+  int cls = 0;
+  FILE *f = fopen("/proc/cpuinfo", "r");
+
+  if (f != NULL) {
+    while (fgets(line, sizeof(line), f) != NULL) {
+      if (strncmp(line, "model name", 10) == 0 && (v = strchr(line, ':')) != NULL) {
+        for (v++; *v == ' '; v++) ;
+        strncpy(model, v, sizeof(model) - 1);
+        model[sizeof(model) - 1] = '\0';
+        break;
+      }
+    }
+    fclose(f);
+  }
+  for (p = model; *p; p++) {
+    if (*p == ' ' || *p == '\t') *p = '_';
+    if (*p == '\n') *p = '\0';
+  }
+  while ((1L << (cls + 1)) <= n) cls++;
+  snprintf(key, TUNING_KEYLEN, "%.80s %ld %d %d", model, sysconf(_SC_NPROCESSORS_ONLN), np, cls);
+}
+
+/* Look up the parameters for (np, n) in 'file' on rank 0 and share     */
+/* them (collective). Returns 1 and fills *tp if found.                 */
+static inline int tuning_load(const char *file, int np, long n, tune_params *tp) {
+  int me, found = 0;
+  long v[4];
+  char key[TUNING_KEYLEN], line[TUNING_LINELEN];
+  FILE *f;
+
+  MPI_Comm_rank(MPI_COMM_WORLD, &me);
+  if (me == 0 && (f = fopen(file, "r")) != NULL) {
+    tuning_key(key, np, n);
+    while (fgets(line, sizeof(line), f) != NULL) {
+      size_t k = strlen(key);
+      if (strncmp(line, key, k) == 0 && line[k] == ' ' &&
+          sscanf(line + k, "%ld %ld %ld %ld", &v[0], &v[1], &v[2], &v[3]) == 4) {
+        found = 1;            /* keep going, the last line wins */
+        tp->rb = v[0];
+        tp->cb = v[1];
+        tp->chunk = v[2];
+        tp->threads = v[3];
+      }
+    }
+    fclose(f);
+  }
+  MPI_Bcast(&found, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if (found) MPI_Bcast(tp, 4, MPI_LONG, 0, MPI_COMM_WORLD);
+  return found;
+}
+
+/* Store the parameters for (np, n), replacing an older line for the    */
+/* same key (rank 0 only)                                               */
+static inline void tuning_store(const char *file, int np, long n, const tune_params *tp) {
+  char key[TUNING_KEYLEN], line[TUNING_LINELEN];
+  char *keep[TUNING_MAXLINES];
+  int i, nkeep = 0;
+  size_t k;
+  FILE *f;
+
+  tuning_key(key, np, n);
+  k = strlen(key);
+  if ((f = fopen(file, "r")) != NULL) {
+    while (nkeep < TUNING_MAXLINES && fgets(line, sizeof(line), f) != NULL) {
+      if (!(strncmp(line, key, k) == 0 && line[k] == ' ')) keep[nkeep++] = strdup(line);
+    }
+    fclose(f);
+  }
+  if ((f = fopen(file, "w")) == NULL) {
+    printf("Cannot write tuning file %s\n", file);
+  } else {
+    for (i = 0; i < nkeep; i++) fputs(keep[i], f);
+    fprintf(f, "%s %ld %ld %ld %ld\n", key, tp->rb, tp->cb, tp->chunk, tp->threads);
+    fclose(f);
+  }
+  for (i = 0; i < nkeep; i++) free(keep[i]);
+}
+
+#endif /* TUNING_H */